@@ -0,0 +1,438 @@
+//
+//    Native benchmark of the morph, voronoi and skeleton pipelines (see CMakeLists.txt)
+//
+//    bench_escher [-r repeats] [-t tiles] [-d dumpfile] [image.png | directory ...]
+//
+//    -d writes every morphed image to dumpfile, compareOptLevels.sh uses it to compare builds.
+//    Without arguments all images in src/lib/images are used. Every image gets a synthetic
+//    silhouette (ellipse around the center, transparent pixels excluded), a skelleton cross and a
+//    square outline, the voronoi sites are an L shaped skelleton per tile of a tiles x tiles tiling.
+//    The "10k sites" voronoi stages use a LARGE_VORONOI_TILES x LARGE_VORONOI_TILES tiling regardless of -t.
+//
+
+#include "morph.h"
+#include "voronoi.h"
+#include "skeleton.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#ifdef HAVE_PNG
+#include <png.h>
+#endif
+
+using namespace std;
+
+// 58 x 58 tiles of 3 sites are 10092 sites
+#define LARGE_VORONOI_TILES 58
+
+struct BenchImage
+{
+  string name;
+  int w, h;
+  vector<unsigned char> rgba;
+};
+
+#ifdef HAVE_PNG
+bool loadPNG(const string &path, BenchImage &img)
+{
+  png_image image;
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+  if (!png_image_begin_read_from_file(&image, path.c_str()))
+    return false;
+  image.format = PNG_FORMAT_RGBA;
+  img.w = image.width;
+  img.h = image.height;
+  img.rgba.resize(PNG_IMAGE_SIZE(image));
+  if (!png_image_finish_read(&image, NULL, img.rgba.data(), 0, NULL))
+  {
+    png_image_free(&image);
+    return false;
+  }
+  img.name = filesystem::path(path).filename().string();
+  return true;
+}
+#endif
+
+// stand in if libpng is missing
+BenchImage syntheticImage(int w, int h)
+{
+  BenchImage img;
+  img.name = "synthetic";
+  img.w = w;
+  img.h = h;
+  for (int y = 0; y < h; y++)
+    for (int x = 0; x < w; x++)
+    {
+      unsigned char pix[4] = {(unsigned char)(x * 7 + y * 3), (unsigned char)(x * x + y), (unsigned char)(x ^ y), 255};
+      img.rgba.insert(img.rgba.end(), pix, pix + 4);
+    }
+  return img;
+}
+
+struct MorphInput
+{
+  vector<unsigned char> processed;
+  vector<FeatureLine> skelleton, outline;
+  vector<double> M;
+};
+
+FeatureLine line(double x1, double y1, double x2, double y2)
+{
+  return FeatureLine(Point(Vector2d(x1, y1)), Point(Vector2d(x2, y2)));
+}
+
+// the skelleton cross of a tile centered at (cx, cy), the offsets keep the points off the pixel grid
+vector<FeatureLine> skelletonCross(double cx, double cy, double size)
+{
+  cx += 0.377;
+  cy += 0.377;
+  vector<FeatureLine> lines;
+  lines.push_back(line(cx - size, cy, cx + size + 0.21, cy + 0.13));
+  lines.push_back(line(cx + 0.11, cy - size - 0.3, cx, cy + size));
+  return lines;
+}
+
+MorphInput makeMorphInput(const BenchImage &img)
+{
+  MorphInput in;
+  double cx = img.w / 2, cy = img.h / 2;
+  double rx = img.w * 0.37, ry = img.h * 0.37;
+
+  // processed image: white silhouette on black
+  in.processed.resize(img.rgba.size());
+  for (int y = 0; y < img.h; y++)
+    for (int x = 0; x < img.w; x++)
+    {
+      size_t i = ((size_t)y * img.w + x) * 4;
+      double ex = (x - cx) / rx, ey = (y - cy) / ry;
+      unsigned char v = (ex * ex + ey * ey < 1 && img.rgba[i + 3] >= 128) ? 255 : 0;
+      in.processed[i] = in.processed[i + 1] = in.processed[i + 2] = v;
+      in.processed[i + 3] = 255;
+    }
+
+  in.skelleton = skelletonCross(cx, cy, Min(rx, ry) * 0.4);
+
+  // square outline in 10 px steps
+  int lo_x = cx - 0.45 * img.w, hi_x = cx + 0.45 * img.w;
+  int lo_y = cy - 0.45 * img.h, hi_y = cy + 0.45 * img.h;
+  vector<Vector2d> pts;
+  for (int x = lo_x; x < hi_x; x += 10)
+    pts.push_back(Vector2d(x, lo_y));
+  for (int y = lo_y; y < hi_y; y += 10)
+    pts.push_back(Vector2d(hi_x, y));
+  for (int x = hi_x; x > lo_x; x -= 10)
+    pts.push_back(Vector2d(x, hi_y));
+  for (int y = hi_y; y > lo_y; y -= 10)
+    pts.push_back(Vector2d(lo_x, y));
+  for (size_t i = 0; i < pts.size(); i++)
+    in.outline.push_back(FeatureLine(Point(pts[i]), Point(pts[(i + 1) % pts.size()])));
+
+  double M[] = {1, 0, 0, 1, 0, 0};
+  in.M.assign(M, M + 6);
+  return in;
+}
+
+struct VoronoiInput
+{
+  vector<double> bbox;
+  vector<int> points, segments;
+  vector<int> pointColors, segmentColors;
+  vector<int> pointTileIdxs, segmentTileIdxs;
+  // the same sites as template and tile transforms
+  vector<double> templatePoints, templateSegments, tileTransforms;
+  vector<int> tileColors, tileIdxs;
+};
+
+// an L shaped skelleton (like the example tilings) and a point per tile, boost::polygon needs non intersecting segments
+VoronoiInput makeVoronoiInput(const BenchImage &img, int tiles)
+{
+  VoronoiInput in;
+  double bbox[] = {0, 0, (double)img.w * tiles, (double)img.h * tiles};
+  in.bbox.assign(bbox, bbox + 4);
+  int size = Min(img.w, img.h) * 0.15;
+  for (int ty = 0; ty < tiles; ty++)
+    for (int tx = 0; tx < tiles; tx++)
+    {
+      int tileIdx = ty * tiles + tx;
+      int cx = tx * img.w + img.w / 2, cy = ty * img.h + img.h / 2;
+      int s[] = {cx - size, cy, cx, cy,
+                 cx, cy, cx, cy - size};
+      in.segments.insert(in.segments.end(), s, s + 8);
+      for (int i = 0; i < 2; i++)
+      {
+        in.segmentColors.push_back(tileIdx % 3);
+        in.segmentTileIdxs.push_back(tileIdx);
+      }
+      in.points.push_back(cx + size);
+      in.points.push_back(cy + size);
+      in.pointColors.push_back(tileIdx % 3);
+      in.pointTileIdxs.push_back(tileIdx);
+
+      double T[] = {1, 0, 0, 1, (double)(cx - img.w / 2), (double)(cy - img.h / 2)};
+      in.tileTransforms.insert(in.tileTransforms.end(), T, T + 6);
+      in.tileColors.push_back(tileIdx % 3);
+      in.tileIdxs.push_back(tileIdx);
+    }
+  int cx = img.w / 2, cy = img.h / 2;
+  double s[] = {(double)(cx - size), (double)cy, (double)cx, (double)cy,
+                (double)cx, (double)cy, (double)cx, (double)(cy - size)};
+  in.templateSegments.assign(s, s + 8);
+  in.templatePoints.push_back(cx + size);
+  in.templatePoints.push_back(cy + size);
+  return in;
+}
+
+double now()
+{
+  return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// best of repeats in ms
+template <typename F>
+double timeIt(int repeats, F f)
+{
+  double best = HUGENUMBER;
+  for (int i = 0; i < repeats; i++)
+  {
+    double t0 = now();
+    f();
+    best = Min(best, (now() - t0) * 1000);
+  }
+  return best;
+}
+
+// raw output of every morph run (-d)
+FILE *dump = NULL;
+
+void report(const BenchImage &img, const char *stage, double ms)
+{
+  printf("%-12s %5dx%-5d %-28s %10.2f ms\n", img.name.c_str(), img.w, img.h, stage, ms);
+  fflush(stdout);
+}
+
+void benchImage(const BenchImage &img, int repeats, int tiles)
+{
+  MorphInput in = makeMorphInput(img);
+  const float p = 0, a = 1, b = 2, t = 0.5;
+
+  long long searchIterations = getSearchIterations();
+  long long badLoops = getBadLoops();
+  report(img, "getMorphOutline", timeIt(repeats, [&]()
+                                        { getMorphOutline(img.w, img.h, t, in.processed, in.skelleton, in.outline, in.M); }));
+  printf("%-12s %11s %-28s %10lld\n", "", "", "  border search iterations", (getSearchIterations() - searchIterations) / repeats);
+  printf("%-12s %11s %-28s %10lld\n", "", "", "  bad loops", (getBadLoops() - badLoops) / repeats);
+  // the vector call builds the distance field every time, the buffer call once per written processed image
+  setMorphProjection(PROJECT_NEAREST);
+  searchIterations = getSearchIterations();
+  report(img, "getMorphOutline nearest", timeIt(repeats, [&]()
+                                                { getMorphOutline(img.w, img.h, t, in.processed, in.skelleton, in.outline, in.M); }));
+  printf("%-12s %11s %-28s %10lld\n", "", "", "  border search iterations", (getSearchIterations() - searchIterations) / repeats);
+  memcpy(imageBuffer(IMAGE_PROCESSED_BUFFER, in.processed.size()), in.processed.data(), in.processed.size());
+  report(img, "getMorphOutline nearest buf", timeIt(repeats, [&]()
+                                                    { getMorphOutlineBuffer(img.w, img.h, t, in.skelleton, in.outline, in.M); }));
+  setMorphProjection(PROJECT_SEARCH);
+
+  // the outline of every tile of a tiles x tiles tiling, shifted by a few pixels against each other
+  vector<FeatureLine> tileOutlines;
+  vector<int> tileSizes;
+  vector<double> tileMatrices;
+  for (int k = 0; k < tiles * tiles; k++)
+  {
+    tileOutlines.insert(tileOutlines.end(), in.outline.begin(), in.outline.end());
+    tileSizes.push_back(in.outline.size());
+    double M[] = {1, 0, 0, 1, (double)(k % tiles) * 3, (double)(k / tiles) * 3};
+    tileMatrices.insert(tileMatrices.end(), M, M + 6);
+  }
+  setMorphThreads(1);
+  report(img, "getMorphOutlines tiles 1T", timeIt(repeats, [&]()
+                                                  { getMorphOutlines(img.w, img.h, t, in.processed, in.skelleton, tileOutlines, tileSizes, tileMatrices); }));
+  setMorphThreads(0);
+  report(img, "getMorphOutlines tiles MT", timeIt(repeats, [&]()
+                                                  { getMorphOutlines(img.w, img.h, t, in.processed, in.skelleton, tileOutlines, tileSizes, tileMatrices); }));
+
+  struct
+  {
+    const char *name;
+    int warpMode;
+    float cutoff;
+    int threads;
+    bool simd;
+  } runs[] = {
+      {"doMorph exact 1T scalar", WARP_EXACT, 0, 1, false},
+      {"doMorph exact 1T simd", WARP_EXACT, 0, 1, true},
+      {"doMorph grid 0.1 1T simd", WARP_GRID, 0.1f, 1, true},
+      {"doMorph exact MT simd", WARP_EXACT, 0, 0, true},
+      {"doMorph grid 0.1 MT simd", WARP_GRID, 0.1f, 0, true},
+  };
+  for (size_t r = 0; r < sizeof(runs) / sizeof(runs[0]); r++)
+  {
+    setMorphThreads(runs[r].threads);
+    setMorphSimd(runs[r].simd);
+    report(img, runs[r].name, timeIt(repeats, [&]()
+                                     { doMorph(img.w, img.h, p, a, b, t, img.rgba, in.processed, in.skelleton, in.outline, in.M,
+                                               runs[r].warpMode, runs[r].cutoff); }));
+    if (dump)
+    {
+      MorphResult result = doMorphWithOutline(img.w, img.h, p, a, b, t, img.rgba, in.processed, in.skelleton, in.outline, in.M,
+                                              runs[r].warpMode, runs[r].cutoff);
+      fwrite(result.image.data(), 1, result.image.size(), dump);
+      for (size_t i = 0; i < result.outline.size(); i++)
+      {
+        double l[] = {result.outline[i].startPoint.x, result.outline[i].startPoint.y, result.outline[i].endPoint.x, result.outline[i].endPoint.y};
+        fwrite(l, sizeof(double), 4, dump);
+      }
+    }
+  }
+  setMorphThreads(0);
+  setMorphSimd(true);
+
+  // every tile of the tiling as its own morph, the outline scaled down to the tile (tile aspects): per call and as
+  // one batch that passes the images, builds the pixmap and the silhouette once and spreads the jobs over the threads
+  vector<FeatureLine> jobOutlines;
+  vector<int> jobSizes;
+  vector<double> jobMatrices;
+  for (int k = 0; k < tiles * tiles; k++)
+  {
+    jobOutlines.insert(jobOutlines.end(), in.outline.begin(), in.outline.end());
+    jobSizes.push_back(in.outline.size());
+    double M[] = {1.0 / tiles, 0, 0, 1.0 / tiles, (double)(k % tiles) * img.w / tiles, (double)(k / tiles) * img.h / tiles};
+    jobMatrices.insert(jobMatrices.end(), M, M + 6);
+  }
+  report(img, "doMorph per tile", timeIt(repeats, [&]()
+                                         {
+                                           for (int k = 0; k < tiles * tiles; k++)
+                                           {
+                                             vector<double> M(jobMatrices.begin() + 6 * k, jobMatrices.begin() + 6 * (k + 1));
+                                             doMorph(img.w, img.h, p, a, b, t, img.rgba, in.processed, in.skelleton, in.outline, M, WARP_GRID, 0.1f);
+                                           } }));
+  report(img, "doMorphBatch tiles", timeIt(repeats, [&]()
+                                           { doMorphBatch(img.w, img.h, p, a, b, t, img.rgba, in.processed, in.skelleton, jobOutlines, jobSizes, jobMatrices,
+                                                          WARP_GRID, 0.1f); }));
+
+  // the outline subdivided to 1 px steps in random order
+  vector<FeatureLine> fine;
+  for (size_t i = 0; i < in.outline.size(); i++)
+  {
+    Vector2d a = in.outline[i].startPoint, b = in.outline[i].endPoint;
+    int steps = std::max((int)(b - a).norm(), 1);
+    for (int k = 0; k < steps; k++)
+      fine.push_back(FeatureLine(Point(a + (b - a) * ((double)k / steps)), Point(a + (b - a) * ((double)(k + 1) / steps))));
+  }
+  srand(1);
+  for (size_t i = fine.size() - 1; i > 0; i--)
+    swap(fine[i], fine[rand() % (i + 1)]);
+  vector<bool> closed;
+  report(img, "assembleOutlineLoops 1px", timeIt(repeats, [&]()
+                                                 { assembleOutlineLoops(fine, 1e-3f, closed); }));
+
+  // skeleton of the opaque pixels, the image is modified in place so every run gets a copy
+  vector<unsigned char> silhouette = img.rgba;
+  for (size_t i = 0; i < silhouette.size(); i += 4)
+    if (silhouette[i + 3] < 128)
+      silhouette[i] = silhouette[i + 1] = silhouette[i + 2] = 0;
+  SkeletonResult skeleton;
+  report(img, "skeleton", timeIt(repeats, [&]()
+                                 { vector<unsigned char> rgba = silhouette;
+                                   build_skeleton(img.w, img.h, rgba.data(), 2, &skeleton); }));
+  printf("%-12s %11s %-28s %zu\n", "", "", "  segments", skeleton.segments.size() / 4);
+
+  VoronoiInput v = makeVoronoiInput(img, tiles);
+  report(img, "voronoi compute", timeIt(repeats, [&]()
+                                        { compute(v.bbox, v.points, v.segments, v.pointColors, v.segmentColors, v.pointTileIdxs, v.segmentTileIdxs); }));
+  // large input independent of -t, the cost of the result assembly grows with the number of edges
+  VoronoiInput large = makeVoronoiInput(img, LARGE_VORONOI_TILES);
+  report(img, "voronoi compute 10k sites", timeIt(repeats, [&]()
+                                                  { compute(large.bbox, large.points, large.segments, large.pointColors, large.segmentColors, large.pointTileIdxs, large.segmentTileIdxs); }));
+  FlatDiagrammResult flat;
+  report(img, "voronoi flat", timeIt(repeats, [&]()
+                                     { build_diagram(v.bbox, v.points, v.segments, v.pointColors, v.segmentColors, v.pointTileIdxs, v.segmentTileIdxs, false, NULL, &flat); }));
+  size_t fullCells = flat.cellFlags.size(), fullVertices = flat.vertices.size() / 2;
+  report(img, "voronoi flat 10k sites", timeIt(repeats, [&]()
+                                               { build_diagram(large.bbox, large.points, large.segments, large.pointColors, large.segmentColors, large.pointTileIdxs, large.segmentTileIdxs, false, NULL, &flat); }));
+  OutlineResult outlines;
+  report(img, "voronoi outlines", timeIt(repeats, [&]()
+                                         { build_outlines(v.bbox, v.points, v.segments, v.pointColors, v.segmentColors, v.pointTileIdxs, v.segmentTileIdxs, false, -1, &outlines); }));
+  // viewport of the center tile, the sites further out are culled
+  vector<double> viewport = {(double)img.w * (tiles / 2), (double)img.h * (tiles / 2), (double)img.w * (tiles / 2 + 1), (double)img.h * (tiles / 2 + 1)};
+  report(img, "voronoi flat center tile", timeIt(repeats, [&]()
+                                                 { build_diagram(viewport, v.points, v.segments, v.pointColors, v.segmentColors, v.pointTileIdxs, v.segmentTileIdxs, true, NULL, &flat); }));
+  report(img, "voronoi tiled flat", timeIt(repeats, [&]()
+                                           { build_tiled_diagram(v.bbox, v.templatePoints, v.templateSegments, v.tileTransforms, v.tileColors, v.tileIdxs, -1, NULL, &flat); }));
+  // the tiled diagram repeats the vertices of the fundamental cells in every tile, the same count means it fell back
+  // to the complete diagram
+  printf("%-12s %11s %-28s %zu / %zu cells, %zu / %zu vertices\n", "", "", "  tiled / full", flat.cellFlags.size(), fullCells,
+         flat.vertices.size() / 2, fullVertices);
+}
+
+int main(int argc, char **argv)
+{
+  int repeats = 3, tiles = 5;
+  vector<string> paths;
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-r") && i + 1 < argc)
+      repeats = std::max(atoi(argv[++i]), 1);
+    else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+      tiles = std::max(atoi(argv[++i]), 1);
+    else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+    {
+      dump = fopen(argv[++i], "wb");
+      if (!dump)
+      {
+        fprintf(stderr, "could not open %s\n", argv[i]);
+        return 1;
+      }
+    }
+    else
+      paths.push_back(argv[i]);
+  }
+#ifdef ESCHER_IMAGE_DIR
+  if (paths.empty())
+    paths.push_back(ESCHER_IMAGE_DIR);
+#endif
+
+  vector<BenchImage> images;
+#ifdef HAVE_PNG
+  vector<string> files;
+  for (size_t i = 0; i < paths.size(); i++)
+  {
+    if (filesystem::is_directory(paths[i]))
+    {
+      for (const auto &entry : filesystem::directory_iterator(paths[i]))
+        if (entry.path().extension() == ".png")
+          files.push_back(entry.path().string());
+    }
+    else
+      files.push_back(paths[i]);
+  }
+  sort(files.begin(), files.end());
+  for (size_t i = 0; i < files.size(); i++)
+  {
+    BenchImage img;
+    if (loadPNG(files[i], img))
+      images.push_back(img);
+    else
+      fprintf(stderr, "could not read %s\n", files[i].c_str());
+  }
+#else
+  fprintf(stderr, "built without libpng, using a synthetic image\n");
+#endif
+  if (images.empty())
+    images.push_back(syntheticImage(500, 500));
+
+  printf("%-12s %11s %-28s best of %d\n", "image", "size", "stage", repeats);
+  for (size_t i = 0; i < images.size(); i++)
+    benchImage(images[i], repeats, tiles);
+  if (dump)
+    fclose(dump);
+  return 0;
+}
@@ -2,19 +2,36 @@
 @REM https://github.com/wolfmcnally/svelte-emscripten
 
 
+@REM buildMorph.bat         release build (shipped): -O3 -flto, no assertions, growing memory
+@REM buildMorph.bat debug   unoptimized build with debug info and assertions
+@REM set NOSIMD=1 to build without -msimd128 (browsers without wasm simd)
+@REM set THREADS=1 to build with pthreads: the morph and the tile tracing then run on a pool of Web Workers
+@REM   (setMorphThreads). The shipped build is single threaded, setMorphThreads has no effect there. A threaded
+@REM   build needs SharedArrayBuffer, so the page has to be served with the COOP/COEP headers
+@REM   (Cross-Origin-Opener-Policy: same-origin, Cross-Origin-Embedder-Policy: require-corp)
+
+set OPT_FLAGS=-O3 -flto -s ALLOW_MEMORY_GROWTH=1
+if "%1"=="debug" set OPT_FLAGS=-O0 -g2 -s ASSERTIONS -sINITIAL_MEMORY=65536000
+
+set SIMD_FLAGS=-msimd128
+if "%NOSIMD%"=="1" set SIMD_FLAGS=
+
+@REM the workers are started with the module, the pool in morph.cpp keeps its threads between calls
+set THREAD_FLAGS=
+if "%THREADS%"=="1" set THREAD_FLAGS=-pthread -s PTHREAD_POOL_SIZE=navigator.hardwareConcurrency
+
 call emcc ^
 -l embind ^
 morph.cpp geometricTool.cpp ^
--O0 ^
--g2 ^
+%OPT_FLAGS% ^
+%SIMD_FLAGS% ^
+%THREAD_FLAGS% ^
 -o ../src/lib/wasm/wasmMorph.js ^
 -s EXPORT_ES6=1 ^
 -s MODULARIZE=1 ^
 -s ENVIRONMENT='web' ^
 -s NO_DISABLE_EXCEPTION_CATCHING ^
 --embind-emit-tsd wasmMorph.d.ts ^
--s ASSERTIONS ^
--sINITIAL_MEMORY=65536000 ^
 -s EXPORTED_RUNTIME_METHODS=['cwrap','ccall']
 
 echo export default function instantiate_wasmMorph(mod^?: any): Promise^<MorphWasmModule^>^; >> ../src/lib/wasm/wasmMorph.d.ts
@@ -0,0 +1,25 @@
+@REM Example Prject: 
+@REM https://github.com/wolfmcnally/svelte-emscripten
+
+
+@REM buildSkeleton.bat         release build (shipped): -O3 -flto, no assertions, growing memory
+@REM buildSkeleton.bat debug   unoptimized build with debug info and assertions
+
+set OPT_FLAGS=-O3 -flto -s ALLOW_MEMORY_GROWTH=1
+if "%1"=="debug" set OPT_FLAGS=-O0 -g2 -s ASSERTIONS -sINITIAL_MEMORY=65536000
+
+call emcc ^
+-l embind ^
+skeleton.cpp ^
+%OPT_FLAGS% ^
+-o ../src/lib/wasm/wasmSkeleton.js ^
+-s EXPORT_ES6=1 ^
+-s MODULARIZE=1 ^
+-s ENVIRONMENT='web' ^
+-s NO_DISABLE_EXCEPTION_CATCHING ^
+--embind-emit-tsd wasmSkeleton.d.ts ^
+-s EXPORTED_RUNTIME_METHODS=['cwrap','ccall']
+
+echo export default function instantiate_wasmSkeleton(mod^?: any): Promise^<SkeletonWasmModule^>^; >> ../src/lib/wasm/wasmSkeleton.d.ts
+
+powershell -Command "(gc ../src/lib/wasm/wasmSkeleton.d.ts) -replace 'MainModule', 'SkeletonWasmModule' | Out-File -encoding ASCII ../src/lib/wasm/wasmSkeleton.d.ts"
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Builds the native library unoptimized (-O0) and as release (-O3) and compares the morph output of
+# bench_escher byte for byte. Undefined behavior tends to show up as a difference between the two.
+#
+#   ./compareOptLevels.sh [-b builddir] [image.png | directory ...]
+#
+# The builds go to builddir/O0 and builddir/O3, without -b to a temporary directory that is removed afterwards.
+# The compare_opt_levels target of the CMake build runs it with a builddir in the build tree.
+set -e
+src="$(cd "$(dirname "$0")" && pwd)"
+
+if [ "$1" = "-b" ] && [ -n "$2" ]; then
+  out="$2"
+  shift 2
+else
+  out="$(mktemp -d)"
+  trap 'rm -rf "$out"' EXIT
+fi
+mkdir -p "$out"
+
+cmake -S "$src" -B "$out/O0" -DCMAKE_BUILD_TYPE=Debug > /dev/null
+cmake -S "$src" -B "$out/O3" -DCMAKE_BUILD_TYPE=Release > /dev/null
+cmake --build "$out/O0" -j --target bench_escher > /dev/null
+cmake --build "$out/O3" -j --target bench_escher > /dev/null
+
+"$out/O0/bench_escher" -r 1 -d "$out/O0/morph.dump" "$@" > /dev/null
+"$out/O3/bench_escher" -r 1 -d "$out/O3/morph.dump" "$@" > /dev/null
+
+if cmp "$out/O0/morph.dump" "$out/O3/morph.dump"; then
+  echo "-O0 and -O3 output identical ($(wc -c < "$out/O3/morph.dump") bytes)"
+else
+  echo "-O0 and -O3 output differ"
+  exit 1
+fi
@@ -13,6 +13,7 @@ public:
 
   Vector2d(double vx = 0, double vy = 0);
   Vector2d(const Vector2d &v);
+  Vector2d& operator=(const Vector2d &v) = default;
 
   double& operator[](int i);
   const double& operator[](int i) const;
@@ -73,6 +74,7 @@ public:
 
   FeatureLine();   // default constructor
   FeatureLine(const Point& start, const Point& end);   // convert constructor
+  FeatureLine(const FeatureLine& line) = default;
 
   // Feature line vector coordinate
   Vector2d coordinate();
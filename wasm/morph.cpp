@@ -5,15 +5,35 @@
 //    modified and extenden by Julian Eder
 //
 
+#ifdef __EMSCRIPTEN__
 #include <emscripten/bind.h>
 using namespace emscripten;
+#else
+#define EMSCRIPTEN_KEEPALIVE
+#endif
 
 using namespace std;
 
-#include "geometricTool.h"
+#include "morph.h"
+#include "simd4.h"
 #include <cstdio>
+#include <cmath>
 #include <vector>
 #include <limits>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <memory>
+#include <new>
+#include <cstring>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+#include <deque>
 
 // the pixel
 typedef struct pix
@@ -23,72 +43,119 @@ typedef struct pix
 
 
 //--------------------------------------------------------------------------
-//------------------------allocPixmap---------------------------------------
+//------------------------pixmap--------------------------------------------
 //--------------------------------------------------------------------------
-// If I compile with -O3 the compiler removes this function when it does not have a print statement in the loop - I dont know why, Julian
-pixel **allocPixmap(int w, int h)
+// row alignment of the pixmap in bytes (cache line)
+#define PIXMAP_ALIGN 64
+
+/* RGBA image in one aligned block, rows are padded to a multiple of 4 pixels (16 bytes).
+   map[row] is a view of the row, map[row][col] the pixel. Owns its memory, move only */
+class Pixmap
 {
-  pixel **map;
-  map = new pixel *[h];
-  map[0] = new pixel[w * h];
+public:
+  Pixmap() : w(0), h(0), stride(0) {}
 
-  for (int i = 1; i < h; i++)
+  // opaque black image
+  Pixmap(int w, int h)
   {
-    map[i] = map[i - 1] + w;
+    allocate(w, h);
+    pixel black = {0, 0, 0, 255};
+    std::fill(data.get(), data.get() + (size_t)stride * this->h, black);
   }
 
-  for (int row = 0; row < h; row++)
+  // copy of a RGBA buffer of w*h pixels
+  Pixmap(int w, int h, const unsigned char *rgba)
   {
-    for (int col = 0; col < w; col++)
-    {
-      map[row][col].r = 0;
-      map[row][col].g = 0;
-      map[row][col].b = 0;
-      map[row][col].a = 255;
-    }
-    // printf("row\n");
+    allocate(w, h);
+    for (int y = 0; y < this->h; y++)
+      memcpy((*this)[y], rgba + (size_t)y * this->w * sizeof(pixel), this->w * sizeof(pixel));
   }
-  return map;
-}
 
-pixel **pixmapFromVector(int w, int h, vector<unsigned char> imageData)
-{
-  pixel **map = new pixel *[h];
-  map[0] = new pixel[w * h];
+  int width() const { return w; }
+  int height() const { return h; }
+  bool empty() const { return w == 0 || h == 0; }
+
+  pixel *operator[](int row) { return data.get() + (size_t)row * stride; }
+  const pixel *operator[](int row) const { return data.get() + (size_t)row * stride; }
 
-  for (int i = 1; i < h; i++)
+  // writes the rows without padding into a RGBA buffer of w*h pixels
+  void copyTo(unsigned char *rgba) const
   {
-    map[i] = map[i - 1] + w;
+    for (int y = 0; y < h; y++)
+      memcpy(rgba + (size_t)y * w * sizeof(pixel), (*this)[y], w * sizeof(pixel));
   }
-  size_t idx = 0;
-  for (int row = 0; row < h; row++)
+
+private:
+  struct AlignedDelete
   {
-    for (int col = 0; col < w; col++)
-    {
-      map[row][col].r = imageData[idx++];
-      map[row][col].g = imageData[idx++];
-      map[row][col].b = imageData[idx++];
-      map[row][col].a = imageData[idx++];
-    }
+    void operator()(pixel *p) const { ::operator delete[](p, std::align_val_t(PIXMAP_ALIGN)); }
+  };
+
+  int w, h, stride;
+  std::unique_ptr<pixel[], AlignedDelete> data;
+
+  void allocate(int w, int h)
+  {
+    this->w = Max(w, 0);
+    this->h = Max(h, 0);
+    stride = (this->w + 3) & ~3;
+    data.reset(static_cast<pixel *>(::operator new[]((size_t)stride * this->h * sizeof(pixel), std::align_val_t(PIXMAP_ALIGN))));
   }
-  return map;
-}
+};
 
-vector<unsigned char> vectorFromPixmap(int w, int h, pixel **map)
+/* silhouette of the processed image, one bit per pixel (set = not black, black is opaque 0, 0, 0). A guard border
+   of black pixels around the image lets the neighbours of a pixel inside the image be read without bounds checks */
+class SilhouetteMask
 {
-  vector<unsigned char> result;
-  for (int y = 0; y < h; y++)
+public:
+  SilhouetteMask() : w(0), h(0), words(0) {}
+
+  // mask of a RGBA buffer of w*h pixels
+  SilhouetteMask(int w, int h, const unsigned char *rgba)
+      : w(Max(w, 0)), h(Max(h, 0)), words((this->w + 2 + 63) / 64), bits((size_t)words * (this->h + 2), 0)
   {
-    for (int x = 0; x < w; x++)
+    for (int y = 0; y < this->h; y++)
     {
-      result.push_back(map[y][x].r);
-      result.push_back(map[y][x].g);
-      result.push_back(map[y][x].b);
-      result.push_back(map[y][x].a);
+      const unsigned char *row = rgba + (size_t)y * this->w * 4;
+      for (int x = 0; x < this->w; x++)
+      {
+        const unsigned char *pix = row + x * 4;
+        if (!(pix[0] == 0 && pix[1] == 0 && pix[2] == 0 && pix[3] == 255))
+          setWhite(x, y);
+      }
     }
   }
-  return result;
-}
+
+  int width() const { return w; }
+  int height() const { return h; }
+  bool empty() const { return w == 0 || h == 0; }
+
+  // everything outside of the image is black
+  bool isBlack(Vector2dInt c) const
+  {
+    if (c.x < 0 || c.x >= w || c.y < 0 || c.y >= h)
+      return true;
+    return isBlackGuarded(c);
+  }
+
+  // c inside of the image or on the guard border
+  bool isBlackGuarded(Vector2dInt c) const
+  {
+    unsigned x = c.x + 1;
+    return !((bits[(size_t)(c.y + 1) * words + (x >> 6)] >> (x & 63)) & 1);
+  }
+
+private:
+  int w, h;
+  int words; // 64 bit words per row, guard border included
+  vector<uint64_t> bits;
+
+  void setWhite(int x, int y)
+  {
+    unsigned gx = x + 1;
+    bits[(size_t)(y + 1) * words + (gx >> 6)] |= (uint64_t)1 << (gx & 63);
+  }
+};
 
 //--------------------------------------------------------------------------------------------------
 //--------------------------line interpolating function---------------------------------------------
@@ -97,7 +164,7 @@ void lineInterpolate(const vector<FeatureLine> sourceLines,
                      const vector<FeatureLine> destLines, vector<FeatureLine> &interLines, float t)
 {
   int i;
-  for (i = 0; i < sourceLines.size(); i++)
+  for (i = 0; i < (int)sourceLines.size(); i++)
   {
     FeatureLine f(
         (1 - t) * (sourceLines[i].startPoint) + t * (destLines[i].startPoint),
@@ -108,72 +175,121 @@ void lineInterpolate(const vector<FeatureLine> sourceLines,
 //---------------------------------------------------------------------------
 
 //--------------------------------------------------------------------------------------------------
-//--------------------------warp function-----------------------------------------------------------
+//--------------------------warp plan---------------------------------------------------------------
 //--------------------------------------------------------------------------------------------------
-/* warping function (backward mapping)
-   input:
-   uv_in = the point in the intermediary image
-   dstLines = given line in the intermediary image
-   srcLines = given line in the source image
-   p, a, b = parameters of the weight function
-   output:
-   uv_out = the corresponding point */
-void warp(const Vector2d &uv_in,
-          const vector<FeatureLine> &srcLines,
-          const vector<FeatureLine> &dstLines,
-          float p, float a, float b, Vector2d &uv_out)
-{
-  int i, j;
-  float interLength, srcLength;
-  float weight, weightSum, dist;
-  float sum_x, sum_y; // weighted sum of the coordination of the point "src"
-  float u, v;
-  Vector2d pd, pq, qd;
-  float X, Y;
-
-  sum_x = 0;
-  sum_y = 0;
-  weightSum = 0;
-
+/* Per line constants of the Beier-Neely warp that do not depend on the pixel, built once per morph.
+   Stored as structure of arrays so the simd kernel can broadcast them directly */
+struct WarpPlan
+{
+  int n;
+  float a, b, p;
+  int bInt; // b as integer exponent (1..4) for the fast path, 0 = use pow
+  vector<float> dsx, dsy;             // destination line start point
+  vector<float> dex, dey;             // destination line end point
+  vector<float> dx, dy;               // destination line vector PQ
+  vector<float> invLength2, invLength; // 1/|PQ|^2, 1/|PQ|
+  vector<float> ssx, ssy;             // source line start point
+  vector<float> sdx, sdy;             // source line vector P'Q'
+  vector<float> sdxN, sdyN;           // P'Q' / |P'Q'|
+  vector<float> lengthP;              // |PQ|^p
+};
+
+WarpPlan buildWarpPlan(const vector<FeatureLine> &srcLines,
+                       const vector<FeatureLine> &dstLines,
+                       float p, float a, float b)
+{
   if (srcLines.size() != dstLines.size())
     throw std::runtime_error("Different Number of Features for warp");
 
-  for (i = 0; i < srcLines.size(); i++)
+  WarpPlan plan;
+  plan.n = dstLines.size();
+  plan.a = a;
+  plan.b = b;
+  plan.p = p;
+  plan.bInt = (b == (int)b && b >= 1 && b <= 4) ? (int)b : 0;
+  for (int i = 0; i < plan.n; i++)
   {
-    pd.x = uv_in.x - dstLines[i].startPoint.x;
-    pd.y = uv_in.y - dstLines[i].startPoint.y;
-    pq.x = dstLines[i].endPoint.x - dstLines[i].startPoint.x;
-    pq.y = dstLines[i].endPoint.y - dstLines[i].startPoint.y;
-    interLength = pq.x * pq.x + pq.y * pq.y;
-    u = (pd.x * pq.x + pd.y * pq.y) / interLength;
+    float dx = dstLines[i].endPoint.x - dstLines[i].startPoint.x;
+    float dy = dstLines[i].endPoint.y - dstLines[i].startPoint.y;
+    float length2 = dx * dx + dy * dy;
+    float length = sqrt(length2);
+    float sdx = srcLines[i].endPoint.x - srcLines[i].startPoint.x;
+    float sdy = srcLines[i].endPoint.y - srcLines[i].startPoint.y;
+    float srcLength = sqrt(sdx * sdx + sdy * sdy);
+
+    plan.dsx.push_back(dstLines[i].startPoint.x);
+    plan.dsy.push_back(dstLines[i].startPoint.y);
+    plan.dex.push_back(dstLines[i].endPoint.x);
+    plan.dey.push_back(dstLines[i].endPoint.y);
+    plan.dx.push_back(dx);
+    plan.dy.push_back(dy);
+    plan.invLength2.push_back(1.0f / length2);
+    plan.invLength.push_back(1.0f / length);
+    plan.ssx.push_back(srcLines[i].startPoint.x);
+    plan.ssy.push_back(srcLines[i].startPoint.y);
+    plan.sdx.push_back(sdx);
+    plan.sdy.push_back(sdy);
+    plan.sdxN.push_back(sdx / srcLength);
+    plan.sdyN.push_back(sdy / srcLength);
+    plan.lengthP.push_back(pow(length, p));
+  }
+  return plan;
+}
 
-    interLength = sqrt(interLength); // length of the vector PQ
+// (lengthP / (a + dist))^b with the integer exponent fast path
+inline float warpWeight(const WarpPlan &plan, float base)
+{
+  switch (plan.bInt)
+  {
+  case 1:
+    return base;
+  case 2:
+    return base * base;
+  case 3:
+    return base * base * base;
+  case 4:
+    return (base * base) * (base * base);
+  default:
+    return pow(base, plan.b);
+  }
+}
 
-    v = (pd.x * pq.y - pd.y * pq.x) / interLength;
+/* warping function (backward mapping) on the prepared plan: uv_out is the point of the source image for the point
+   uv_in of the intermediary image, weighted over the feature lines. lineIdx/nLines select the lines to evaluate
+   (grid mode), lineIdx = NULL evaluates all nLines lines */
+void warpWithPlan(const Vector2d &uv_in, const WarpPlan &plan,
+                  const int *lineIdx, int nLines, Vector2d &uv_out)
+{
+  float x = uv_in.x;
+  float y = uv_in.y;
+  float sum_x = 0;
+  float sum_y = 0;
+  float weightSum = 0;
 
-    pq.x = srcLines[i].endPoint.x - srcLines[i].startPoint.x;
-    pq.y = srcLines[i].endPoint.y - srcLines[i].startPoint.y;
+  for (int k = 0; k < nLines; k++)
+  {
+    int i = lineIdx ? lineIdx[k] : k;
+    float pdx = x - plan.dsx[i];
+    float pdy = y - plan.dsy[i];
+    float u = (pdx * plan.dx[i] + pdy * plan.dy[i]) * plan.invLength2[i];
+    float v = (pdx * plan.dy[i] - pdy * plan.dx[i]) * plan.invLength[i];
 
-    srcLength = sqrt(pq.x * pq.x + pq.y * pq.y); // length of the vector P'Q'
-    // corresponding point based on the ith line
-    X = srcLines[i].startPoint.x + u * pq.x + v * pq.y / srcLength;
-    Y = srcLines[i].startPoint.y + u * pq.y - v * pq.x / srcLength;
+    float X = plan.ssx[i] + u * plan.sdx[i] + v * plan.sdyN[i];
+    float Y = plan.ssy[i] + u * plan.sdy[i] - v * plan.sdxN[i];
 
-    // the distance from the corresponding point to the line P'Q'
+    float dist;
     if (u < 0)
-      dist = sqrt(pd.x * pd.x + pd.y * pd.y);
+      dist = sqrt(pdx * pdx + pdy * pdy);
     else if (u > 1)
     {
-      qd.x = uv_in.x - dstLines[i].endPoint.x;
-      qd.y = uv_in.y - dstLines[i].endPoint.y;
-      dist = sqrt(qd.x * qd.x + qd.y * qd.y);
+      float qdx = x - plan.dex[i];
+      float qdy = y - plan.dey[i];
+      dist = sqrt(qdx * qdx + qdy * qdy);
     }
     else
-    {
-      dist = abs(v);
-    }
+      dist = fabs(v);
 
-    weight = pow(pow(interLength, p) / (a + dist), b);
+    float weight = warpWeight(plan, plan.lengthP[i] / (plan.a + dist));
     sum_x += X * weight;
     sum_y += Y * weight;
     weightSum += weight;
@@ -183,10 +299,121 @@ void warp(const Vector2d &uv_in,
   uv_out.y = sum_y / weightSum;
 }
 
+//--------------------------------------------------------------------------------------------------
+//--------------------------accelerated warp--------------------------------------------------------
+//--------------------------------------------------------------------------------------------------
+#define WARP_GRID_CELL_SIZE 16
+
+/* uniform grid over the destination bbox, every cell stores the indices of the
+   feature lines whose weight can not be neglected anywhere inside the cell */
+struct WarpGrid
+{
+  int xl, yl;
+  int nx, ny;
+  int cellSize;
+  vector<int> cellStart; // nx*ny+1 offsets into lineIdx
+  vector<int> lineIdx;
+};
+
+// distance from point q to the line segment (s, e), same metric as in warpWithPlan
+float distToLine(const Vector2d &q, const FeatureLine &line)
+{
+  Vector2d pq = line.endPoint - line.startPoint;
+  Vector2d pd = q - line.startPoint;
+  double l = pq.x * pq.x + pq.y * pq.y;
+  double u = (l > 0) ? (pd.x * pq.x + pd.y * pq.y) / l : 0;
+  if (u < 0)
+    return sqrt(pd.x * pd.x + pd.y * pd.y);
+  if (u > 1)
+  {
+    Vector2d qd = q - line.endPoint;
+    return sqrt(qd.x * qd.x + qd.y * qd.y);
+  }
+  return abs(pd.x * pq.y - pd.y * pq.x) / sqrt(l);
+}
+
+/* For every cell a lower bound of the total weight (every line at its farthest distance from the cell) and an
+   upper bound of each line weight (at its closest distance) are computed. The lines with the smallest upper bounds
+   are skipped as long as their summed upper bounds stay below cutoff * lower bound of the total weight, so the
+   skipped lines never carry more than the fraction cutoff of the weight of any pixel in the cell.
+   The distance to a segment is 1-lipschitz, so center distance -/+ half diagonal gives both bounds.
+   cutoff = 0 keeps every line, the strongest line of a cell is always kept */
+WarpGrid buildWarpGrid(const WarpPlan &plan, const vector<FeatureLine> &dstLines,
+                       int xl, int yl, int xh, int yh, float cutoff)
+{
+  WarpGrid grid;
+  grid.cellSize = WARP_GRID_CELL_SIZE;
+  grid.xl = xl;
+  grid.yl = yl;
+  grid.nx = Max((xh - xl + grid.cellSize - 1) / grid.cellSize, 1);
+  grid.ny = Max((yh - yl + grid.cellSize - 1) / grid.cellSize, 1);
+  grid.cellStart.reserve(grid.nx * grid.ny + 1);
+
+  float halfDiag = grid.cellSize * 0.5f * sqrt(2.0f);
+  vector<pair<float, int> > maxWeight(dstLines.size());
+  for (int cy = 0; cy < grid.ny; cy++)
+  {
+    for (int cx = 0; cx < grid.nx; cx++)
+    {
+      Vector2d center(xl + (cx + 0.5) * grid.cellSize, yl + (cy + 0.5) * grid.cellSize);
+      float minWeightSum = 0;
+      for (int i = 0; i < (int)dstLines.size(); i++)
+      {
+        float dist = distToLine(center, dstLines[i]);
+        minWeightSum += warpWeight(plan, plan.lengthP[i] / (plan.a + dist + halfDiag));
+        maxWeight[i] = make_pair(warpWeight(plan, plan.lengthP[i] / (plan.a + Max(dist - halfDiag, 0.0f))), i);
+      }
+      sort(maxWeight.begin(), maxWeight.end());
+
+      // skip the weakest lines while their summed weight stays below the budget
+      float budget = cutoff * minWeightSum;
+      float skipped = 0;
+      int first = 0;
+      while (first + 1 < (int)maxWeight.size() && skipped + maxWeight[first].first <= budget)
+      {
+        skipped += maxWeight[first].first;
+        first++;
+      }
+
+      grid.cellStart.push_back(grid.lineIdx.size());
+      for (int k = first; k < (int)maxWeight.size(); k++)
+        grid.lineIdx.push_back(maxWeight[k].second);
+      // keep the line order of the exact warp so the float sums are accumulated in the same order
+      sort(grid.lineIdx.begin() + grid.cellStart.back(), grid.lineIdx.end());
+    }
+  }
+  grid.cellStart.push_back(grid.lineIdx.size());
+  return grid;
+}
+
+// weightCutoff of the morph calls has to be in [0, 1), the skipped lines carry at most that fraction of the weight
+void checkWeightCutoff(float weightCutoff)
+{
+  if (!(weightCutoff >= 0 && weightCutoff < 1))
+    throw std::runtime_error("weightCutoff outside of [0, 1)");
+}
+
+// warpMode of the morph calls has to be WARP_EXACT or WARP_GRID, anything else would silently run the exact warp
+void checkWarpMode(int warpMode)
+{
+  if (warpMode != WARP_EXACT && warpMode != WARP_GRID)
+    throw std::runtime_error("Unknown warpMode " + std::to_string(warpMode));
+}
+
+/* the lines to evaluate for the destination pixel (x, y) */
+inline void gridCellLines(const WarpGrid &grid, int x, int y, const int *&lineIdx, int &nLines)
+{
+  int cx = Min(Max((x - grid.xl) / grid.cellSize, 0), grid.nx - 1);
+  int cy = Min(Max((y - grid.yl) / grid.cellSize, 0), grid.ny - 1);
+  int cell = cy * grid.nx + cx;
+  lineIdx = grid.lineIdx.data() + grid.cellStart[cell];
+  nLines = grid.cellStart[cell + 1] - grid.cellStart[cell];
+}
+
 //--------------------------------------------------------------------------------------------------
 //--------------------------bilinear interpolation--------------------------------------------------
 //--------------------------------------------------------------------------------------------------
-pixel bilinear(pixel **&Im, float row, float col)
+pixel bilinear(const Pixmap &Im, float row, float col)
 {
   int cm, cn, fm, fn;
   double alpha, beta;
@@ -207,82 +434,455 @@ pixel bilinear(pixel **&Im, float row, float col)
 }
 //---------------------------------------------------------------------------
 
+//--------------------------------------------------------------------------------------------------
+//--------------------------simd warp and bilinear interpolation------------------------------------
+//--------------------------------------------------------------------------------------------------
+// use the 4 pixel kernel if the build supports it (see simd4.h)
+bool morphSimd = true;
+
+EMSCRIPTEN_KEEPALIVE void setMorphSimd(bool enabled)
+{
+  morphSimd = enabled;
+}
+
+#if MORPH_SIMD
+/* warpWithPlan for 4 destination pixels at once, the line constants are broadcast to all lanes */
+void warp4(f4 x, f4 y, const WarpPlan &plan, const int *lineIdx, int nLines, f4 &out_x, f4 &out_y)
+{
+  f4 sum_x = f4_set1(0);
+  f4 sum_y = f4_set1(0);
+  f4 weightSum = f4_set1(0);
+  f4 zero = f4_set1(0);
+  f4 one = f4_set1(1);
+  f4 va = f4_set1(plan.a);
+
+  for (int k = 0; k < nLines; k++)
+  {
+    int i = lineIdx ? lineIdx[k] : k;
+    f4 dx = f4_set1(plan.dx[i]);
+    f4 dy = f4_set1(plan.dy[i]);
+
+    f4 pdx = f4_sub(x, f4_set1(plan.dsx[i]));
+    f4 pdy = f4_sub(y, f4_set1(plan.dsy[i]));
+    f4 u = f4_mul(f4_add(f4_mul(pdx, dx), f4_mul(pdy, dy)), f4_set1(plan.invLength2[i]));
+    f4 v = f4_mul(f4_sub(f4_mul(pdx, dy), f4_mul(pdy, dx)), f4_set1(plan.invLength[i]));
+
+    f4 X = f4_add(f4_set1(plan.ssx[i]), f4_add(f4_mul(u, f4_set1(plan.sdx[i])), f4_mul(v, f4_set1(plan.sdyN[i]))));
+    f4 Y = f4_add(f4_set1(plan.ssy[i]), f4_sub(f4_mul(u, f4_set1(plan.sdy[i])), f4_mul(v, f4_set1(plan.sdxN[i]))));
+
+    // the distance to the line segment, the lanes may need different branches so both end distances are computed
+    f4 qdx = f4_sub(x, f4_set1(plan.dex[i]));
+    f4 qdy = f4_sub(y, f4_set1(plan.dey[i]));
+    f4 distStart = f4_sqrt(f4_add(f4_mul(pdx, pdx), f4_mul(pdy, pdy)));
+    f4 distEnd = f4_sqrt(f4_add(f4_mul(qdx, qdx), f4_mul(qdy, qdy)));
+    f4 dist = f4_select(f4_lt(u, zero), distStart, f4_select(f4_gt(u, one), distEnd, f4_abs(v)));
+
+    f4 base = f4_div(f4_set1(plan.lengthP[i]), f4_add(va, dist));
+    f4 weight;
+    if (plan.bInt > 0)
+    {
+      weight = base;
+      for (int e = 1; e < plan.bInt; e++)
+        weight = f4_mul(weight, base);
+    }
+    else
+    {
+      float lanes[4];
+      f4_store(lanes, base);
+      weight = f4_set(pow(lanes[0], plan.b), pow(lanes[1], plan.b), pow(lanes[2], plan.b), pow(lanes[3], plan.b));
+    }
+
+    sum_x = f4_add(sum_x, f4_mul(X, weight));
+    sum_y = f4_add(sum_y, f4_mul(Y, weight));
+    weightSum = f4_add(weightSum, weight);
+  }
+
+  out_x = f4_div(sum_x, weightSum);
+  out_y = f4_div(sum_y, weightSum);
+}
+
+/* bilinear interpolation of 4 source positions (already clamped to the image) written to dst[0..3] */
+void bilinear4(const Pixmap &Im, int w, int h, f4 row, f4 col, pixel *dst)
+{
+  f4 fm = f4_floor(row);
+  f4 fn = f4_floor(col);
+  f4 beta_m = f4_sub(row, fm); // weight of the row below
+  f4 beta_n = f4_sub(col, fn); // weight of the column right
+  float fmL[4], fnL[4], bmL[4], bnL[4];
+  f4_store(fmL, fm);
+  f4_store(fnL, fn);
+  f4_store(bmL, beta_m);
+  f4_store(bnL, beta_n);
+
+  for (int k = 0; k < 4; k++)
+  {
+    int m0 = (int)fmL[k];
+    int n0 = (int)fnL[k];
+    int m1 = Min(m0 + 1, h - 1);
+    int n1 = Min(n0 + 1, w - 1);
+    f4 wm = f4_set1(bmL[k]);
+    f4 wn = f4_set1(bnL[k]);
+    f4 one = f4_set1(1);
+
+    const pixel &p00 = Im[m0][n0];
+    const pixel &p01 = Im[m0][n1];
+    const pixel &p10 = Im[m1][n0];
+    const pixel &p11 = Im[m1][n1];
+    f4 top = f4_add(f4_mul(f4_sub(one, wn), f4_set(p00.r, p00.g, p00.b, 0)), f4_mul(wn, f4_set(p01.r, p01.g, p01.b, 0)));
+    f4 bottom = f4_add(f4_mul(f4_sub(one, wn), f4_set(p10.r, p10.g, p10.b, 0)), f4_mul(wn, f4_set(p11.r, p11.g, p11.b, 0)));
+    float c[4];
+    f4_store(c, f4_add(f4_mul(f4_sub(one, wm), top), f4_mul(wm, bottom)));
+
+    dst[k].r = (unsigned int)c[0];
+    dst[k].g = (unsigned int)c[1];
+    dst[k].b = (unsigned int)c[2];
+    dst[k].a = 255;
+  }
+}
+
+/* warps and samples the 4 destination pixels (j..j+3, i) */
+void morphPixels4(int i, int j, int w, int h, const WarpPlan &plan,
+                  int warpMode, const WarpGrid &grid, const Pixmap &srcImgMap, pixel *dst)
+{
+  const int *lineIdx = NULL;
+  int nLines = plan.n;
+  if (warpMode == WARP_GRID)
+    gridCellLines(grid, j, i, lineIdx, nLines);
+
+  f4 x = f4_set(j, j + 1, j + 2, j + 3);
+  f4 y = f4_set1(i);
+  f4 uv_x, uv_y;
+  warp4(x, y, plan, lineIdx, nLines, uv_x, uv_y);
+
+  f4 xMax = f4_set1(w - 1);
+  f4 yMax = f4_set1(h - 1);
+  f4 zero = f4_set1(0);
+  f4 nan = f4_or(f4_isnan(uv_x), f4_isnan(uv_y));
+  int outside = f4_movemask(f4_or(nan, f4_or(f4_or(f4_lt(uv_x, zero), f4_gt(uv_x, xMax)),
+                                             f4_or(f4_lt(uv_y, zero), f4_gt(uv_y, yMax)))));
+  uv_x = f4_select(nan, zero, f4_min(f4_max(uv_x, zero), xMax));
+  uv_y = f4_select(nan, zero, f4_min(f4_max(uv_y, zero), yMax));
+
+  bilinear4(srcImgMap, w, h, uv_y, uv_x, dst);
+  for (int k = 0; k < 4; k++)
+  {
+    if (outside & (1 << k))
+    {
+      dst[k].r = 0;
+      dst[k].g = 0;
+      dst[k].b = 0;
+      dst[k].a = 255;
+    }
+  }
+}
+#endif
+//---------------------------------------------------------------------------
+
 bool approximatelyEqual(float a, float b, float epsilon)
 {
   return fabs(a - b) <= epsilon;
 }
 
-vector<FeatureLine> sortOutlineLines(vector<FeatureLine> &outlineLines)
+// bucket of a point in the endpoint hash, points closer than the bucket size are in the same or a neighbouring bucket
+static inline uint64_t endpointKey(long long qx, long long qy)
 {
-  vector<FeatureLine> sorted;
-  int i = 0;
-  int cnt = 0;
-  do
+  return ((uint64_t)(uint32_t)qx << 32) | (uint32_t)qy;
+}
+
+/* chains the lines to loops, the end point of a line has to match the start point of the next one within tolerance.
+   The start points are hashed by their position quantised to tolerance, so this is linear in the number of lines.
+   Lines that can't be closed to a loop end up in open chains, closed[k] tells if chain k is a loop */
+vector<vector<FeatureLine>> assembleOutlineLoops(const vector<FeatureLine> &lines, float tolerance, vector<bool> &closed)
+{
+  int n = lines.size();
+  unordered_map<uint64_t, int> bucketFirst; // first line starting in the bucket
+  vector<int> bucketNext(n, -1);            // next line starting in the same bucket
+  for (int i = n - 1; i >= 0; i--)          // backwards, so the lists are in ascending order
+  {
+    uint64_t key = endpointKey(floor(lines[i].startPoint.x / tolerance), floor(lines[i].startPoint.y / tolerance));
+    unordered_map<uint64_t, int>::iterator it = bucketFirst.find(key);
+    if (it != bucketFirst.end())
+    {
+      bucketNext[i] = it->second;
+      it->second = i;
+    }
+    else
+      bucketFirst[key] = i;
+  }
+
+  vector<bool> used(n, false);
+  vector<vector<FeatureLine>> chains;
+  closed.clear();
+  for (int first = 0; first < n; first++)
   {
-    bool found = false;
-    for (int j = 0; j < outlineLines.size(); j++)
+    if (used[first])
+      continue;
+    used[first] = true;
+    chains.push_back(vector<FeatureLine>(1, lines[first]));
+    bool loop = false;
+    int i = first;
+    for (;;)
     {
-      if (approximatelyEqual(outlineLines[i].endPoint.x, outlineLines[j].startPoint.x, 1e-3f) && approximatelyEqual(outlineLines[i].endPoint.y, outlineLines[j].startPoint.y, 1e-3f))
+      const Point &end = lines[i].endPoint;
+      if (approximatelyEqual(end.x, lines[first].startPoint.x, tolerance) && approximatelyEqual(end.y, lines[first].startPoint.y, tolerance))
       {
-        found = true;
-        sorted.push_back(outlineLines[i]);
-        i = j;
+        loop = true;
         break;
       }
+
+      // first unused line starting at the end point
+      int next = -1;
+      long long qx = floor(end.x / tolerance), qy = floor(end.y / tolerance);
+      for (int dy = -1; dy <= 1 && next < 0; dy++)
+        for (int dx = -1; dx <= 1 && next < 0; dx++)
+        {
+          unordered_map<uint64_t, int>::const_iterator it = bucketFirst.find(endpointKey(qx + dx, qy + dy));
+          for (int j = it == bucketFirst.end() ? -1 : it->second; j >= 0; j = bucketNext[j])
+          {
+            if (!used[j] && approximatelyEqual(end.x, lines[j].startPoint.x, tolerance) && approximatelyEqual(end.y, lines[j].startPoint.y, tolerance))
+            {
+              next = j;
+              break;
+            }
+          }
+        }
+      if (next < 0)
+        break;
+      used[next] = true;
+      chains.back().push_back(lines[next]);
+      i = next;
     }
-    if (!found)
-      throw std::runtime_error("Not a valid Loop");
-    cnt++;
-  } while (cnt < outlineLines.size());
-  return sorted;
+    closed.push_back(loop);
+  }
+  return chains;
 }
 
-bool isBlack(Vector2dInt c, pixel **srcImgMap, int w, int h)
+// the outline as one loop, the lines must not form several chains or an open one
+vector<FeatureLine> sortOutlineLines(const vector<FeatureLine> &outlineLines)
 {
-  if (c.x < 0 || c.x >= w)
-    return true;
-  if (c.y < 0 || c.y >= h)
-    return true;
-  pixel pix = srcImgMap[c.y][c.x];
-  return pix.r == 0 && pix.g == 0 && pix.b == 0 && pix.a == 255;
+  vector<bool> closed;
+  vector<vector<FeatureLine>> chains = assembleOutlineLoops(outlineLines, 1e-3f, closed);
+  if (chains.size() != 1 || !closed[0])
+  {
+    int open = std::count(closed.begin(), closed.end(), false);
+    throw std::runtime_error("Not a valid Loop: " + std::to_string(chains.size()) + " chains, " + std::to_string(open) + " open");
+  }
+  return chains[0];
 }
 
-Vector2dInt SearchAlongLineRec(Vector2d s, Vector2d d, Vector2dInt prev_c, pixel **srcImgMap, int w, int h, int depth, bool inverse, bool verbose = false)
+bool isBlack(Vector2dInt c, const SilhouetteMask &silhouette)
 {
-  Vector2d center = s + (d / 2.0);
-  Vector2dInt c(center);
-  if (c == prev_c){
-    if(inverse){
-      while (isBlack(c, srcImgMap, w, h)){ // step into the direction a little bit more to garante we are inside the border
-        center = center + (-d / 2.0);
-        c = center;
+  return silhouette.isBlack(c);
+}
+
+//--------------------------------------------------------------------------------------------------
+//--------------------------distance field----------------------------------------------------------
+//--------------------------------------------------------------------------------------------------
+// projection of the black outline end points onto the silhouette (PROJECT_SEARCH / PROJECT_NEAREST, see morph.h)
+int morphProjection = PROJECT_SEARCH;
+
+EMSCRIPTEN_KEEPALIVE void setMorphProjection(int mode)
+{
+  morphProjection = mode == PROJECT_NEAREST ? PROJECT_NEAREST : PROJECT_SEARCH;
+}
+
+// "infinite" squared distance of the distance transform, finite so the parabola intersections stay defined
+#define DISTANCE_INF 1e20
+
+/* 1D squared euclidean distance transform of f (Felzenszwalb & Huttenlocher), d[q] = min_p (q - p)^2 + f[p] and
+   arg[q] the minimizing p. v and z are scratch buffers of n and n + 1 elements */
+static void distanceTransform1D(const double *f, int n, double *d, int *arg, int *v, double *z)
+{
+  int k = 0;
+  v[0] = 0;
+  z[0] = -DISTANCE_INF;
+  z[1] = DISTANCE_INF;
+  for (int q = 1; q < n; q++)
+  {
+    double s = ((f[q] + (double)q * q) - (f[v[k]] + (double)v[k] * v[k])) / (2.0 * q - 2.0 * v[k]);
+    while (s <= z[k])
+    {
+      k--;
+      s = ((f[q] + (double)q * q) - (f[v[k]] + (double)v[k] * v[k])) / (2.0 * q - 2.0 * v[k]);
+    }
+    k++;
+    v[k] = q;
+    z[k] = s;
+    z[k + 1] = DISTANCE_INF;
+  }
+  k = 0;
+  for (int q = 0; q < n; q++)
+  {
+    while (z[k + 1] < q)
+      k++;
+    d[q] = (double)(q - v[k]) * (q - v[k]) + f[v[k]];
+    arg[q] = v[k];
+  }
+}
+
+/* nearest white (not black) pixel of every pixel of the processed image, built in linear time by the separable
+   distance transform (nearest pixel in the row, then the parabolas over the columns). Built once per image, the
+   lookups are O(1) */
+class DistanceField
+{
+public:
+  DistanceField() : w(0), h(0) {}
+
+  DistanceField(const SilhouetteMask &silhouette)
+      : w(silhouette.width()), h(silhouette.height()), nearestPixel((size_t)w * h, -1)
+  {
+    // per row: squared distance and column of the nearest white pixel in the row, two sweeps
+    vector<double> rowDist((size_t)w * h, DISTANCE_INF);
+    vector<int> rowNearest((size_t)w * h, -1);
+    bool white = false;
+    for (int y = 0; y < h; y++)
+    {
+      double *dist = &rowDist[(size_t)y * w];
+      int *nearest = &rowNearest[(size_t)y * w];
+      for (int x = 0, last = -1; x < w; x++)
+      {
+        if (!silhouette.isBlackGuarded(Vector2dInt(x, y)))
+          last = x;
+        nearest[x] = last;
       }
-    }else{
-      while (isBlack(c, srcImgMap, w, h)){ // step into the direction a little bit more to garante we are inside the border
-        center = center + (d / 2.0);
-        c = center;
+      for (int x = w - 1, last = -1; x >= 0; x--)
+      {
+        if (nearest[x] == x)
+          last = x;
+        if (last >= 0 && (nearest[x] < 0 || last - x < x - nearest[x]))
+          nearest[x] = last;
+        if (nearest[x] >= 0)
+          dist[x] = (double)(nearest[x] - x) * (nearest[x] - x);
       }
+      white = white || nearest[0] >= 0;
+    }
+    if (!white)
+      return;
+    // per column over the row distances: the row of the nearest pixel
+    vector<double> f(h), d(h), z(h + 1);
+    vector<int> arg(h), v(h);
+    for (int x = 0; x < w; x++)
+    {
+      for (int y = 0; y < h; y++)
+        f[y] = rowDist[(size_t)y * w + x];
+      distanceTransform1D(f.data(), h, d.data(), arg.data(), v.data(), z.data());
+      for (int y = 0; y < h; y++)
+        nearestPixel[(size_t)y * w + x] = arg[y] * w + rowNearest[(size_t)arg[y] * w + x];
     }
-    return c;
   }
 
-  if(verbose) printf("depth %d\n", depth);
-  if(verbose) printf("s (%f %f)\n", s.x, s.y);
-  if(verbose) printf("d (%f %f)\n", d.x, d.y);
-  if(verbose) printf("d/2 (%f %f)\n", (d / 2.0).x, (d / 2.0).y);
-  if(verbose) printf("center (%f %f)\n", center.x, center.y);
+  bool empty() const { return w == 0 || h == 0; }
+
+  // nearest white pixel of c, false if c is outside of the image or the image has no white pixels
+  bool nearest(Vector2dInt c, Vector2dInt &result) const
+  {
+    if (c.x < 0 || c.x >= w || c.y < 0 || c.y >= h)
+      return false;
+    int idx = nearestPixel[(size_t)c.y * w + c.x];
+    if (idx < 0)
+      return false;
+    result = Vector2dInt(idx % w, idx / w);
+    return true;
+  }
+
+private:
+  int w, h;
+  vector<int> nearestPixel; // y * w + x of the nearest white pixel, -1 if there is none
+};
 
-  if (isBlack(c, srcImgMap, w, h))
+/* silhouette and distance field of a processed image. The buffer entry points (doMorphBuffer, getMorphOutlineBuffer,
+   ...) share the one of the last image written to the processed image buffer, so like in a MorphSession the field
+   is built once per image, not per call */
+struct ProcessedImage
+{
+  int w, h;
+  long long generation; // of the processed image buffer, UNCACHED_IMAGE for the images passed as vectors
+  SilhouetteMask silhouette;
+  DistanceField field; // built on the first PROJECT_NEAREST use
+
+  // the field for projection, NULL for PROJECT_SEARCH
+  const DistanceField *projectionField(int projection) const { return projection == PROJECT_NEAREST ? &field : NULL; }
+};
+
+// generation of an image that is not kept, the images passed as vectors can change from call to call unnoticed
+#define UNCACHED_IMAGE -1
+
+std::mutex processedImageMutex;
+std::shared_ptr<ProcessedImage> lastProcessedImage;
+
+/* the processed image of the w * h RGBA image, with the field if projection needs it. An image with a generation
+   (the processed image buffer, which counts the writes) is reused while the generation stays the same, the others
+   are built for the call */
+std::shared_ptr<const ProcessedImage> processedImage(int w, int h, const unsigned char *rgba, int projection,
+                                                     long long generation)
+{
+  std::unique_lock<std::mutex> lock(processedImageMutex, std::defer_lock);
+  std::shared_ptr<ProcessedImage> image;
+  if (generation != UNCACHED_IMAGE)
   {
-    if(verbose) printf("B c (%d %d)\n", c.x, c.y);
-    return SearchAlongLineRec(center, d / 2.0, c, srcImgMap, w, h, depth + 1, inverse, verbose);
+    lock.lock();
+    image = lastProcessedImage;
   }
-  else
+  if (!image || image->w != w || image->h != h || image->generation != generation)
   {
-    if(verbose) printf("W c (%d %d)\n", c.x, c.y);
-    return SearchAlongLineRec(s, d / 2.0, c, srcImgMap, w, h, depth + 1, inverse, verbose);
+    image = std::make_shared<ProcessedImage>();
+    image->w = w;
+    image->h = h;
+    image->generation = generation;
+    image->silhouette = SilhouetteMask(w, h, rgba);
+    if (generation != UNCACHED_IMAGE)
+      lastProcessedImage = image;
   }
-  
+  if (projection == PROJECT_NEAREST && image->field.empty())
+    image->field = DistanceField(image->silhouette);
+  return image;
+}
+
+// iterations of all SearchAlongLine calls, for profiling (getSearchIterations)
+static std::atomic<long long> searchIterations(0);
+
+// d is halved every iteration, after this many the rounded midpoint repeats for every image size
+#define SEARCH_MAX_HALVINGS 64
+
+/* binary search for the silhouette border on the line from s to s + d (s black, s + d white), returns the first
+   white pixel. The line is halved until the rounded midpoint repeats, then it steps further along d (back along d
+   if inverse) until it is inside of the silhouette. Both loops are bounded. With a field the steps end early at the
+   nearest white pixel once the search is inside of the image */
+Vector2dInt SearchAlongLine(Vector2d s, Vector2d d, const SilhouetteMask &silhouette, bool inverse,
+                            const DistanceField *field = NULL)
+{
+  Vector2dInt prev_c(s);
+  Vector2d center = s + (d / 2.0);
+  Vector2dInt c(center);
+  int iterations = 1;
+  while (!(c == prev_c) && iterations < SEARCH_MAX_HALVINGS)
+  {
+    if (isBlack(c, silhouette))
+      s = center;
+    d = d / 2.0;
+    prev_c = c;
+    center = s + (d / 2.0);
+    c = center;
+    iterations++;
+  }
+
+  // outside of the image everything is black, so the steps are bounded too
+  Vector2d step = inverse ? -d / 2.0 : d / 2.0;
+  int steps = 0;
+  while (isBlack(c, silhouette) && steps++ < silhouette.width() + silhouette.height())
+  { // step into the direction a little bit more to garante we are inside the border
+    if (field && field->nearest(c, c))
+      break;
+    center = center + step;
+    c = center;
+  }
+  searchIterations += iterations + steps;
+  return c;
+}
+
+long long getSearchIterations()
+{
+  return searchIterations;
 }
 
 Vector2d transformPoint(Vector2d v, vector<double> M)
@@ -301,180 +901,137 @@ Vector2d transformDirection(Vector2d v, vector<double> M)
   return r;
 }
 
-Point closetsPointOnSkelleton(Vector2d p, vector<FeatureLine> skelletonLines){
-  
-  Vector2d e;
+/* KD-tree over the end points of the skelleton lines for the nearest end point queries of projectOutlineLines.
+   Finds the same end point as checking all lines in order (start before end point, the first one on ties) */
+class EndpointTree
+{
+public:
+  EndpointTree(const vector<FeatureLine> &lines)
+  {
+    for (int j = 0; j < (int)lines.size(); j++)
+    {
+      Node start = {lines[j].startPoint.x, lines[j].startPoint.y, 2 * j};
+      Node end = {lines[j].endPoint.x, lines[j].endPoint.y, 2 * j + 1};
+      nodes.push_back(start);
+      nodes.push_back(end);
+    }
+    build(0, nodes.size(), 0);
+  }
 
-  float dist_s = std::numeric_limits<float>::max();
-  bool isStartClosest = false;
-  int idx_s_closest = -1;
-  
-  for (int j = 0; j < skelletonLines.size(); j++)
+  // nearest end point, 2 * line for the start point and 2 * line + 1 for the end point, -1 if there are no lines
+  int nearest(const Vector2d &p) const
   {
-    // We work with squared distances to avoid sqrt
-    // The s point has to be transformed, because outlineLines is in tiling space, while skelletonLines is in imageSpace
+    float best = std::numeric_limits<float>::max();
+    int bestIdx = -1;
+    search(0, nodes.size(), 0, p, best, bestIdx);
+    return bestIdx;
+  }
 
-    e.x = skelletonLines[j].startPoint.x;
-    e.y = skelletonLines[j].startPoint.y;
-    float d_p_s = (p.x - e.x) * (p.x - e.x) + (p.y - e.y) * (p.y - e.y);
+private:
+  struct Node
+  {
+    double x, y;
+    int idx;
+  };
+  // the median of [lo, hi) is the node, the halves are split by the other axis
+  vector<Node> nodes;
 
-    e.x = skelletonLines[j].endPoint.x;
-    e.y = skelletonLines[j].endPoint.y;
-    float d_p_e = (p.x - e.x) * (p.x - e.x) + (p.y - e.y) * (p.y - e.y);
+  static bool lessX(const Node &a, const Node &b) { return a.x < b.x; }
+  static bool lessY(const Node &a, const Node &b) { return a.y < b.y; }
 
+  void build(int lo, int hi, int depth)
+  {
+    if (hi - lo < 2)
+      return;
+    int mid = (lo + hi) / 2;
+    std::nth_element(nodes.begin() + lo, nodes.begin() + mid, nodes.begin() + hi, depth % 2 ? lessY : lessX);
+    build(lo, mid, depth + 1);
+    build(mid + 1, hi, depth + 1);
+  }
 
-    if (d_p_s < dist_s)
+  void search(int lo, int hi, int depth, const Vector2d &p, float &best, int &bestIdx) const
+  {
+    if (lo >= hi)
+      return;
+    int mid = (lo + hi) / 2;
+    const Node &node = nodes[mid];
+    // squared distance rounded to float like the brute force search did
+    float d = (p.x - node.x) * (p.x - node.x) + (p.y - node.y) * (p.y - node.y);
+    if (d < best || (d == best && node.idx < bestIdx))
     {
-      isStartClosest = true;
-      idx_s_closest = j;
-      dist_s = d_p_s;
+      best = d;
+      bestIdx = node.idx;
     }
-    if (d_p_e < dist_s)
+
+    double diff = depth % 2 ? p.y - node.y : p.x - node.x;
+    if (diff < 0)
+      search(lo, mid, depth + 1, p, best, bestIdx);
+    else
+      search(mid + 1, hi, depth + 1, p, best, bestIdx);
+    // the slack keeps points whose float distance rounds down to best
+    if (diff * diff * (1 - 1e-6) <= best)
     {
-      isStartClosest = false;
-      idx_s_closest = j;
-      dist_s = d_p_e;
+      if (diff < 0)
+        search(mid + 1, hi, depth + 1, p, best, bestIdx);
+      else
+        search(lo, mid, depth + 1, p, best, bestIdx);
     }
   }
+};
 
-  // Move Direction (Start Point)
-  if (isStartClosest)
-  {
-    e.x = skelletonLines[idx_s_closest].startPoint.x;
-    e.y = skelletonLines[idx_s_closest].startPoint.y;
-  }
-  else
-  {
-    e.x = skelletonLines[idx_s_closest].endPoint.x;
-    e.y = skelletonLines[idx_s_closest].endPoint.y;
-  }
-
-  return e;
+// the end point idx of EndpointTree::nearest
+Vector2d skelletonEndpoint(const vector<FeatureLine> &skelletonLines, int idx)
+{
+  const Point &e = idx % 2 ? skelletonLines[idx / 2].endPoint : skelletonLines[idx / 2].startPoint;
+  return Vector2d(e.x, e.y);
 }
 
-vector<FeatureLine> projectOutlineLines(vector<FeatureLine> &outlineLines, vector<FeatureLine> skelletonLines, pixel **srcImgMap, int w, int h)
+/* moves the black end points of the outline lines onto the silhouette, by a search towards the closest skelleton end
+   point or, if field is set, to the nearest white pixel (points outside of the image are still searched until the
+   search enters the image) */
+vector<FeatureLine> projectOutlineLines(vector<FeatureLine> &outlineLines, const vector<FeatureLine> &skelletonLines,
+                                        const SilhouetteMask &silhouette, const DistanceField *field)
 {
+  if (skelletonLines.empty())
+    throw std::runtime_error("Empty skelleton");
+  EndpointTree skelletonEndpoints(skelletonLines);
+
   vector<FeatureLine> outlineLinesMorphed;
-  for (int i = 0; i < outlineLines.size(); i++)
+  for (int i = 0; i < (int)outlineLines.size(); i++)
   {
-    // find closest
+    // the search directions point to the closest skelleton end points
     Vector2d d, s, e;
 
-    float dist_s = std::numeric_limits<float>::max();
-    float dist_e = std::numeric_limits<float>::max();
-    bool s_isStartClosest = false;
-    bool e_isStartClosest = false;
-    int idx_s_closest = -1;
-    int idx_e_closest = -1;
-    for (int j = 0; j < skelletonLines.size(); j++)
-    {
-      // We work with squared distances to avoid sqrt
-      // The s point has to be transformed, because outlineLines is in tiling space, while skelletonLines is in imageSpace
-
-      s.x = outlineLines[i].startPoint.x;
-      s.y = outlineLines[i].startPoint.y;
-      e.x = skelletonLines[j].startPoint.x;
-      e.y = skelletonLines[j].startPoint.y;
-      float d_s_s = (s.x - e.x) * (s.x - e.x) + (s.y - e.y) * (s.y - e.y);
-
-      e.x = skelletonLines[j].endPoint.x;
-      e.y = skelletonLines[j].endPoint.y;
-      float d_s_e = (s.x - e.x) * (s.x - e.x) + (s.y - e.y) * (s.y - e.y);
-
-      s.x = outlineLines[i].endPoint.x;
-      s.y = outlineLines[i].endPoint.y;
-      e.x = skelletonLines[j].startPoint.x;
-      e.y = skelletonLines[j].startPoint.y;
-
-      float d_e_s = (s.x - e.x) * (s.x - e.x) + (s.y - e.y) * (s.y - e.y);
-
-      e.x = skelletonLines[j].endPoint.x;
-      e.y = skelletonLines[j].endPoint.y;
-      float d_e_e = (s.x - e.x) * (s.x - e.x) + (s.y - e.y) * (s.y - e.y);
-
-      if (d_s_s < dist_s)
-      {
-        s_isStartClosest = true;
-        idx_s_closest = j;
-        dist_s = d_s_s;
-      }
-      if (d_s_e < dist_s)
-      {
-        s_isStartClosest = false;
-        idx_s_closest = j;
-        dist_s = d_s_e;
-      }
-
-      if (d_e_s < dist_e)
-      {
-        e_isStartClosest = true;
-        idx_e_closest = j;
-        dist_e = d_e_s;
-      }
-      if (d_e_e < dist_e)
-      {
-        e_isStartClosest = false;
-        idx_e_closest = j;
-        dist_e = d_e_e;
-      }
-    }
-
     // Move Direction (Start Point)
-    if (s_isStartClosest)
-    {
-      s.x = outlineLines[i].startPoint.x;
-      s.y = outlineLines[i].startPoint.y;
-      e.x = skelletonLines[idx_s_closest].startPoint.x;
-      e.y = skelletonLines[idx_s_closest].startPoint.y;
-      d.x = e.x - s.x;
-      d.y = e.y - s.y;
-    }
-    else
-    {
-      s.x = outlineLines[i].startPoint.x;
-      s.y = outlineLines[i].startPoint.y;
-      e.x = skelletonLines[idx_s_closest].endPoint.x;
-      e.y = skelletonLines[idx_s_closest].endPoint.y;
-      d.x = e.x - s.x;
-      d.y = e.y - s.y;
-    }
+    s.x = outlineLines[i].startPoint.x;
+    s.y = outlineLines[i].startPoint.y;
+    e = skelletonEndpoint(skelletonLines, skelletonEndpoints.nearest(s));
+    d.x = e.x - s.x;
+    d.y = e.y - s.y;
 
     // If we start serach inside the image (because the tile border is inside the texture) we search outwards instead with a max search of the distance to the skelletal line
     Vector2dInt shift_s;
-    if(!isBlack(s, srcImgMap, w, h)){
+    if(!isBlack(s, silhouette)){
       shift_s = s;
-    }else{
+    }else if(!field || !field->nearest(s, shift_s)){
       // Binary Search Along Line
-      shift_s = SearchAlongLineRec(s, d, s, srcImgMap, w, h, 0, false);
+      shift_s = SearchAlongLine(s, d, silhouette, false, field);
     }
 
     // Move Direction (End Point)
-    if (e_isStartClosest)
-    {
-      s.x = outlineLines[i].endPoint.x;
-      s.y = outlineLines[i].endPoint.y;
-      e.x = skelletonLines[idx_e_closest].startPoint.x;
-      e.y = skelletonLines[idx_e_closest].startPoint.y;
-      d.x = e.x - s.x;
-      d.y = e.y - s.y;
-    }
-    else
-    {
-      s.x = outlineLines[i].endPoint.x;
-      s.y = outlineLines[i].endPoint.y;
-      e.x = skelletonLines[idx_e_closest].endPoint.x;
-      e.y = skelletonLines[idx_e_closest].endPoint.y;
-      d.x = e.x - s.x;
-      d.y = e.y - s.y;
-    }
+    s.x = outlineLines[i].endPoint.x;
+    s.y = outlineLines[i].endPoint.y;
+    e = skelletonEndpoint(skelletonLines, skelletonEndpoints.nearest(s));
+    d.x = e.x - s.x;
+    d.y = e.y - s.y;
 
     Vector2dInt shift_e;
     // If we start serach inside the image (because the tile border is inside the texture) we search outwards instead with a max search of the distance to the skelletal line
-    if(!isBlack(s, srcImgMap, w, h)){
+    if(!isBlack(s, silhouette)){
       shift_e = s;
-    }else{
+    }else if(!field || !field->nearest(s, shift_e)){
       // Binary Search Along Line
-      shift_e = SearchAlongLineRec(s, d, s, srcImgMap, w, h, 0, false);
+      shift_e = SearchAlongLine(s, d, silhouette, false, field);
     }
 
     outlineLinesMorphed.push_back(FeatureLine(Point(shift_s), Point(shift_e)));
@@ -499,49 +1056,33 @@ void removeZeroLengthLines(vector<FeatureLine> &outlineLinesSorted, vector<Featu
   }
 }
 
-bool isBoundaryPoint(Vector2dInt c, pixel **srcImgMap, int w, int h)
+// c is not black but one of its 4 neighbours is (the neighbours of a pixel inside the image are on the guard border at most)
+bool isBoundaryPoint(Vector2dInt c, const SilhouetteMask &silhouette)
 {
-  if(isBlack(c, srcImgMap, w, h)){
+  if(isBlack(c, silhouette)){
     return false;
   }else{
     Vector2dInt N(c.x, c.y-1);
     Vector2dInt S(c.x, c.y+1);
     Vector2dInt E(c.x+1, c.y);
     Vector2dInt W(c.x-1, c.y);
-    return isBlack(N, srcImgMap, w, h)
-        || isBlack(S, srcImgMap, w, h)
-        || isBlack(E, srcImgMap, w, h)
-        || isBlack(W, srcImgMap, w, h);
+    return silhouette.isBlackGuarded(N)
+        || silhouette.isBlackGuarded(S)
+        || silhouette.isBlackGuarded(E)
+        || silhouette.isBlackGuarded(W);
   }
 }
 
 
-Vector2dInt* neigh(Vector2dInt p){
-      static Vector2dInt n[8];
-      n[0].x = p.x-1;
-      n[0].y = p.y-1;
-
-      n[1].x = p.x;
-      n[1].y = p.y-1;
-      
-      n[2].x = p.x+1;
-      n[2].y = p.y-1;
-      
-      n[3].x = p.x+1;
-      n[3].y = p.y;
-
-      n[4].x = p.x+1;
-      n[4].y = p.y+1;
-
-      n[5].x = p.x;
-      n[5].y = p.y+1;
-
-      n[6].x = p.x-1;
-      n[6].y = p.y+1;
+// the 8 neighbours of a pixel clockwise from the top left
+static const int NEIGH_DX[8] = {-1, 0, 1, 1, 1, 0, -1, -1};
+static const int NEIGH_DY[8] = {-1, -1, -1, 0, 1, 1, 1, 0};
 
-      n[7].x = p.x-1;
-      n[7].y = p.y;
-      return n;
+// neighbour i of p, i is taken modulo 8 (negative too). No state, so tracing can run on several threads
+inline Vector2dInt neighbour(Vector2dInt p, int i)
+{
+  i &= 7;
+  return Vector2dInt(p.x + NEIGH_DX[i], p.y + NEIGH_DY[i]);
 }
 
 bool neighContain(Vector2dInt p, Vector2dInt g){
@@ -553,7 +1094,7 @@ bool neighContain(Vector2dInt p, Vector2dInt g){
   return false;
 }
 
-void subdivideAlongBoundary(vector<Vector2dInt>& boundaryPoints, vector<FeatureLine>::iterator& it, vector<FeatureLine>::iterator& it_o, vector<FeatureLine>& outlineLinesSorted, vector<FeatureLine>& outlineLinesMorphed, vector<FeatureLine>& result_inner, vector<FeatureLine>& result_outer, bool verbose = false){
+void subdivideAlongBoundary(vector<Vector2dInt>& boundaryPoints, vector<FeatureLine>::iterator& it, vector<FeatureLine>::iterator& it_o, vector<FeatureLine>& result_inner, vector<FeatureLine>& result_outer){
 
   int l = boundaryPoints.size();
   int steps = (l / 20) + 1;
@@ -597,103 +1138,300 @@ void subdivideAlongBoundary(vector<Vector2dInt>& boundaryPoints, vector<FeatureL
   boundaryPoints.clear();
 }
 
-void traceBoundary(
-  vector<FeatureLine> &outlineLinesSorted, 
-  vector<FeatureLine> &outlineLinesMorphed, 
-  vector<FeatureLine> skelletonLines, 
-  vector<FeatureLine> &result_inner,
-  vector<FeatureLine> &result_outer,
-  pixel **srcImgMap, int w, int h){  
-
-  vector<FeatureLine>::iterator it_o = outlineLinesSorted.begin();
-  vector<FeatureLine>::iterator it_end = outlineLinesMorphed.end();
-
-  int idx_seg = 0;
-  for (vector<FeatureLine>::iterator it = outlineLinesMorphed.begin(); it < it_end; ++it, ++it_o, ++idx_seg){
-    if(!isBoundaryPoint(it->startPoint, srcImgMap, w, h) || !isBoundaryPoint(it->endPoint, srcImgMap, w, h))
+/* one step of the Moore neighbour walk along the silhouette boundary: clockwise from the first black neighbour of p
+   to the first white one. The step only depends on p. false if p has no black or no white neighbour, p has to be
+   inside of the image */
+bool nextBoundaryPixel(Vector2dInt p, const SilhouetteMask &silhouette, Vector2dInt &next)
+{
+  int idx_b = -1;
+  for (int i = 0; i < 8; i++)
+  {
+    if (silhouette.isBlackGuarded(neighbour(p, i)))
     {
-      result_inner.push_back(*it);
-      result_outer.push_back(*it_o);
-      continue;
+      idx_b = i;
+      break;
+    }
+  }
+  if (idx_b < 0)
+    return false;
+  for (int i = 1; i < 8; i++)
+  {
+    Vector2dInt n = neighbour(p, idx_b + i);
+    if (!silhouette.isBlackGuarded(n))
+    {
+      next = n;
+      return true;
     }
+  }
+  return false;
+}
 
-    FeatureLine prev_line;
-    if(it == outlineLinesMorphed.begin()) 
-      prev_line = outlineLinesMorphed[outlineLinesMorphed.size()-1];
-    else
-      prev_line = outlineLinesMorphed[idx_seg-1];
+/* the walk from a pixel along the boundary: the pixels of tail (tail[0] is the start pixel), then the pixels of a
+   closed contour from entry on, round and round */
+struct BoundaryWalk
+{
+  vector<Vector2dInt> tail;
+  const vector<Vector2dInt> *contour;
+  int entry;
 
-    vector<Vector2dInt> boundaryPoints;
-    Vector2dInt p = it->startPoint;
-    Vector2dInt b;
-    int idx_b = -1;
-    
-    Vector2dInt *n = neigh(p);
-
-    int nNEIGH = 8;
-    for(int i = 0; i < nNEIGH; i++){
-      if(isBlack(n[i], srcImgMap, w, h)){
-        b = n[i];
-        idx_b = i;
+  // pixel after step k
+  Vector2dInt operator[](long long k) const
+  {
+    if (k < (long long)tail.size())
+      return tail[k];
+    return (*contour)[(entry + (k - tail.size())) % contour->size()];
+  }
+};
+
+/* the closed contours of the boundary walk, each traced once and indexed by pixel. The walk from a pixel is a (mostly
+   empty) tail into one of them, the boundary between two pixels a slice of it */
+class BoundaryContours
+{
+public:
+  BoundaryContours(const SilhouetteMask &silhouette) : silhouette(silhouette) {}
+
+  // the walk from p, traces the contour it runs into if that is not indexed yet. false if p has no next pixel
+  bool walk(Vector2dInt p, BoundaryWalk &result)
+  {
+    result.tail.clear();
+    int contour, pos;
+    if (find(p, contour, pos))
+    {
+      result.contour = &contours[contour];
+      result.entry = pos;
+      return true;
+    }
+
+    std::unordered_map<int64_t, int> seen;
+    vector<Vector2dInt> &walk = result.tail;
+    Vector2dInt q = p;
+    while (true)
+    {
+      seen[key(q)] = walk.size();
+      walk.push_back(q);
+      if (!nextBoundaryPixel(q, silhouette, q))
+        return false;
+      if (find(q, contour, pos))
+        break;
+      auto found = seen.find(key(q));
+      if (found != seen.end())
+      {
+        // a new contour from q on
+        contour = contours.size();
+        pos = 0;
+        contours.push_back(vector<Vector2dInt>(walk.begin() + found->second, walk.end()));
+        for (int i = 0; i < (int)contours.back().size(); i++)
+          index[key(contours.back()[i])] = std::make_pair(contour, i);
+        walk.resize(found->second);
         break;
       }
     }
+    result.contour = &contours[contour];
+    result.entry = pos;
+    return true;
+  }
 
-    bool backwardFound = false;
-    bool forwardFoundAfterBackward = false;
-    int cnt = 0;
-    while(cnt++ < w*h){
+  /* first step >= 1 at which the walk passes p and the period after which it passes it again (0 for never),
+     -1 if it never passes p */
+  long long firstStep(const BoundaryWalk &walk, Vector2dInt p, long long &period) const
+  {
+    period = 0;
+    for (int k = 1; k < (int)walk.tail.size(); k++)
+    {
+      if (walk.tail[k] == p)
+        return k;
+    }
+    int contour, pos;
+    if (!find(p, contour, pos) || &contours[contour] != walk.contour)
+      return -1;
+    long long l = walk.contour->size();
+    period = l;
+    long long step = walk.tail.size() + (pos - walk.entry + l) % l;
+    return step == 0 ? l : step;
+  }
 
-      for(int i = 0; i < nNEIGH; i++){
-        if(isBlack(n[i], srcImgMap, w, h)){
-          idx_b = i;
-          break;
-        }
-      }
+private:
+  const SilhouetteMask &silhouette;
+  std::deque<vector<Vector2dInt>> contours; // stable addresses for BoundaryWalk::contour
+  std::unordered_map<int64_t, std::pair<int, int>> index;
 
-      for(int i = 0; i < nNEIGH; i++){
-        if(!isBlack(n[(idx_b + i) % nNEIGH], srcImgMap, w, h)){
-          p = n[(idx_b + i) % nNEIGH];
-          b = n[(idx_b + i - 1) % nNEIGH];
-          idx_b = (idx_b + i - 1) % nNEIGH;
-          boundaryPoints.push_back(p);
-          n = neigh(p);
-          break;
-        }
+  static int64_t key(Vector2dInt p) { return ((int64_t)p.y << 32) | (uint32_t)p.x; }
+
+  bool find(Vector2dInt p, int &contour, int &pos) const
+  {
+    auto found = index.find(key(p));
+    if (found == index.end())
+      return false;
+    contour = found->second.first;
+    pos = found->second.second;
+    return true;
+  }
+};
+
+// outline lines whose boundary walk came back to the start point before it reached the end point (getBadLoops)
+static std::atomic<long long> badLoops(0);
+
+long long getBadLoops()
+{
+  return badLoops;
+}
+
+/* walks the boundary from the start point of the morphed line to its end point. If the walk passes the start point of
+   the previous line first it runs the wrong way round, the boundary from the end point back to the start point is
+   taken then. Step by step, for start points without a next pixel */
+void walkBoundary(vector<FeatureLine>::iterator &it, vector<FeatureLine>::iterator &it_o, const FeatureLine &prev_line,
+                  vector<FeatureLine> &result_inner, vector<FeatureLine> &result_outer,
+                  const SilhouetteMask &silhouette)
+{
+  vector<Vector2dInt> boundaryPoints;
+  Vector2dInt p = it->startPoint;
+
+  bool backwardFound = false;
+  bool forwardFoundAfterBackward = false;
+  int cnt = 0;
+  int pixels = silhouette.width() * silhouette.height();
+  while(cnt++ < pixels){
+
+    Vector2dInt next;
+    if(nextBoundaryPixel(p, silhouette, next)){
+      p = next;
+      boundaryPoints.push_back(p);
+    }
+
+    if(p == it->endPoint)
+    {
+      if(backwardFound){
+
+        boundaryPoints.clear();
+        forwardFoundAfterBackward = true;
+        boundaryPoints.push_back(it->endPoint);
+
+      }else{
+
+        subdivideAlongBoundary(boundaryPoints, it, it_o, result_inner, result_outer);
+
+        break;
+      }
+    }
+    else if(p == prev_line.startPoint){
+      backwardFound = true;
+    }
+    else if(p == it->startPoint)
+    {
+      if(forwardFoundAfterBackward){
+        reverse(boundaryPoints.begin(),boundaryPoints.end());
+        subdivideAlongBoundary(boundaryPoints, it, it_o, result_inner, result_outer);
+        break;
+      }else{
+        badLoops++;
+        break;
       }
+    }
+  }
+}
 
-      if(p == it->endPoint)
-      {
-        if(backwardFound){
+// a step at which the walk of walkBoundary passes one of its check points
+struct WalkEvent
+{
+  long long step;
+  int point; // WALK_END, WALK_PREV or WALK_START, checked in this order
 
-          boundaryPoints.clear();
-          forwardFoundAfterBackward = true;
-          boundaryPoints.push_back(it->endPoint);
+  bool operator<(const WalkEvent &e) const { return step < e.step || (step == e.step && point < e.point); }
+};
 
-        }else{
+#define WALK_END   0
+#define WALK_PREV  1
+#define WALK_START 2
+
+/* the silhouette boundary between the morphed points for every outline line, the same as walkBoundary. The contours
+   are traced once and the walk is evaluated only at the steps where it passes the end point, the start point of the
+   previous line or its own start point, so a line costs the length of its boundary slice */
+void traceBoundary(
+  vector<FeatureLine> &outlineLinesSorted, 
+  vector<FeatureLine> &outlineLinesMorphed, 
+  vector<FeatureLine> &result_inner,
+  vector<FeatureLine> &result_outer,
+  const SilhouetteMask &silhouette){
+
+  BoundaryContours contours(silhouette);
+  BoundaryWalk walk;
+  long long pixels = (long long)silhouette.width() * silhouette.height();
 
-          if(!(p == it->endPoint))
-            boundaryPoints.push_back(p);
+  vector<FeatureLine>::iterator it_o = outlineLinesSorted.begin();
+  vector<FeatureLine>::iterator it_end = outlineLinesMorphed.end();
+
+  int idx_seg = 0;
+  for (vector<FeatureLine>::iterator it = outlineLinesMorphed.begin(); it < it_end; ++it, ++it_o, ++idx_seg){
+    if(!isBoundaryPoint(it->startPoint, silhouette) || !isBoundaryPoint(it->endPoint, silhouette))
+    {
+      result_inner.push_back(*it);
+      result_outer.push_back(*it_o);
+      continue;
+    }
 
-          subdivideAlongBoundary(boundaryPoints, it, it_o, outlineLinesSorted, outlineLinesMorphed, result_inner, result_outer);
-          
+    FeatureLine prev_line;
+    if(it == outlineLinesMorphed.begin()) 
+      prev_line = outlineLinesMorphed[outlineLinesMorphed.size()-1];
+    else
+      prev_line = outlineLinesMorphed[idx_seg-1];
+
+    if(!contours.walk(it->startPoint, walk))
+    {
+      walkBoundary(it, it_o, prev_line, result_inner, result_outer, silhouette);
+      continue;
+    }
+
+    // the walk is periodic after the tail and its state only changes twice, after three rounds it runs to the step limit
+    Vector2dInt points[3] = {it->endPoint, prev_line.startPoint, it->startPoint};
+    vector<WalkEvent> events;
+    long long horizon = walk.tail.size() + 3 * (long long)walk.contour->size();
+    for (int i = 0; i < 3; i++)
+    {
+      long long period;
+      long long step = contours.firstStep(walk, points[i], period);
+      for (; step >= 0 && step <= horizon; step += period)
+      {
+        WalkEvent e = {step, i};
+        events.push_back(e);
+        if (period == 0)
+          break;
+      }
+    }
+    std::sort(events.begin(), events.end());
+
+    vector<Vector2dInt> boundaryPoints;
+    bool backwardFound = false;
+    bool forwardFoundAfterBackward = false;
+    long long lastEnd = 0;
+    for (int e = 0; e < (int)events.size(); e++){
+      long long step = events[e].step;
+      if (step > pixels)
+        break;
+      if (e > 0 && step == events[e - 1].step)
+        continue; // only the first matching check runs
+      if (events[e].point == WALK_END){
+        if (backwardFound){
+          forwardFoundAfterBackward = true;
+          lastEnd = step;
+        }else{
+          for (long long k = 1; k <= step; k++)
+            boundaryPoints.push_back(walk[k]);
+          subdivideAlongBoundary(boundaryPoints, it, it_o, result_inner, result_outer);
           break;
         }
       }
-      else if(p == prev_line.startPoint){
-        int l = boundaryPoints.size();
+      else if (events[e].point == WALK_PREV){
         backwardFound = true;
       }
-      else if(p == it->startPoint)
-      {
-        if(forwardFoundAfterBackward){
-          reverse(boundaryPoints.begin(),boundaryPoints.end());
-          subdivideAlongBoundary(boundaryPoints, it, it_o, outlineLinesSorted, outlineLinesMorphed, result_inner, result_outer, true);
-          break;
+      else{
+        if (forwardFoundAfterBackward){
+          for (long long k = step; k >= lastEnd; k--)
+            boundaryPoints.push_back(walk[k]);
+          subdivideAlongBoundary(boundaryPoints, it, it_o, result_inner, result_outer);
         }else{
-          printf("found bad loop \n");
-          break;
+          badLoops++;
         }
+        break;
       }
     }
 
@@ -704,7 +1442,7 @@ void traceBoundary(
 
 void transformAll(vector<FeatureLine> &outlineLines, vector<double> M)
 {
-  for (int i = 0; i < outlineLines.size(); i++)
+  for (int i = 0; i < (int)outlineLines.size(); i++)
   {
     outlineLines[i].startPoint = transformPoint(outlineLines[i].startPoint, M);
     outlineLines[i].endPoint = transformPoint(outlineLines[i].endPoint, M);
@@ -712,27 +1450,340 @@ void transformAll(vector<FeatureLine> &outlineLines, vector<double> M)
 }
 
 //--------------------------------------------------------------------------------------------------
-//--------------------------morph-------------------------------------------------------------------
+//--------------------------threaded morph----------------------------------------------------------
 //--------------------------------------------------------------------------------------------------
-EMSCRIPTEN_KEEPALIVE vector<FeatureLine> getMorphOutline(int w, int h, float t,
-                                                         vector<unsigned char> imageData,
-                                                         vector<FeatureLine> skelletonLines,
-                                                         vector<FeatureLine> outlineLines,
-                                                         vector<double> Minv)
+// number of worker threads for the morph loop, 0 = one per hardware thread
+int morphThreads = 0;
+
+EMSCRIPTEN_KEEPALIVE void setMorphThreads(int n)
+{
+  morphThreads = Max(n, 0);
+}
+
+/* threads for `jobs` independent pieces of work: morphThreads or one per hardware thread, at most jobs, 1 without
+   pthreads (plain wasm build) */
+int workerThreads(int jobs)
+{
+  int nThreads = 1;
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+  nThreads = morphThreads > 0 ? morphThreads : (int)std::thread::hardware_concurrency();
+  nThreads = Min(Max(nThreads, 1), jobs);
+#endif
+  return nThreads;
+}
+
+/* Persistent pool of worker threads. run(n, job) calls job on the caller and n - 1 pool threads and returns when all
+   of them are done, the first exception of a job is rethrown on the caller. The threads are started on first use and
+   then sleep between runs, so under emscripten pthreads a morph does not start Web Workers. A run from inside of a job
+   calls job on the current thread only */
+class WorkerPool
+{
+public:
+  WorkerPool() : job(NULL), helpers(0), pending(0), generation(0), stopping(false) {}
+
+  ~WorkerPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (int k = 0; k < (int)threads.size(); k++)
+      threads[k].join();
+  }
+
+  template <typename F>
+  void run(int nThreads, F &f)
+  {
+    std::function<void()> job(std::ref(f));
+    if (nThreads <= 1 || insideJob)
+    {
+      job();
+      return;
+    }
+
+    std::lock_guard<std::mutex> runLock(runMutex); // one run at a time
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      while ((int)threads.size() < nThreads - 1)
+        threads.push_back(std::thread(&WorkerPool::loop, this, (int)threads.size()));
+      this->job = &job;
+      helpers = nThreads - 1;
+      pending = helpers;
+      error = std::exception_ptr();
+      generation++;
+    }
+    wake.notify_all();
+
+    std::exception_ptr callerError;
+    insideJob = true;
+    try
+    {
+      job();
+    }
+    catch (...)
+    {
+      callerError = std::current_exception();
+    }
+    insideJob = false;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() { return pending == 0; });
+    this->job = NULL;
+    if (callerError)
+      std::rethrow_exception(callerError);
+    if (error)
+      std::rethrow_exception(error);
+  }
+
+private:
+  std::mutex runMutex;
+  std::mutex mutex; // guards everything below
+  std::condition_variable wake, done;
+  vector<std::thread> threads;
+  const std::function<void()> *job;
+  int helpers;   // threads[0 .. helpers) take part in the current run
+  int pending;   // of them still running
+  long long generation;
+  bool stopping;
+  std::exception_ptr error; // first one of the pool threads
+  static thread_local bool insideJob;
+
+  void loop(int index)
+  {
+    insideJob = true;
+    long long seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+      wake.wait(lock, [&]() { return stopping || generation != seen; });
+      if (stopping)
+        return;
+      seen = generation;
+      if (index >= helpers)
+        continue;
+
+      const std::function<void()> *f = job;
+      lock.unlock();
+      std::exception_ptr jobError;
+      try
+      {
+        (*f)();
+      }
+      catch (...)
+      {
+        jobError = std::current_exception();
+      }
+      lock.lock();
+      if (jobError && !error)
+        error = jobError;
+      if (--pending == 0)
+        done.notify_all();
+    }
+  }
+};
+
+thread_local bool WorkerPool::insideJob = false;
+
+WorkerPool workerPool;
+
+// rows handed out to a worker at once
+#define MORPH_ROW_BLOCK 8
+
+/* warps and samples the destination rows [rowBegin, rowEnd) of the bbox (xl, yl, xh, *) into morphMap */
+void morphRows(int rowBegin, int rowEnd, int xl, int yl, int xh, int w, int h,
+               const WarpPlan &plan, int warpMode, const WarpGrid &grid,
+               const Pixmap &srcImgMap, Pixmap &morphMap)
+{
+  Vector2d uv_src;
+  Vector2d uv_dst;
+  const int *lineIdx = NULL;
+  int nLines = plan.n;
+
+  for (int i = rowBegin; i < rowEnd; i++)
+  {
+    int j = xl;
+#if MORPH_SIMD
+    // groups of 4 pixels, the remaining pixels of the row run through the scalar path
+    if (morphSimd)
+    {
+      for (; j + 4 <= xh; j += 4)
+        morphPixels4(i, j, w, h, plan, warpMode, grid, srcImgMap, &morphMap[i - yl][j - xl]);
+    }
+#endif
+    for (; j < xh; j++)
+    {
+      uv_dst.x = j;
+      uv_dst.y = i;
+
+      // warping
+      if (warpMode == WARP_GRID)
+        gridCellLines(grid, j, i, lineIdx, nLines);
+      warpWithPlan(uv_dst, plan, lineIdx, nLines, uv_src);
+
+      // NaN if no line has a weight (0 / 0), casting it to a pixel index would be undefined
+      bool outside = std::isnan(uv_src.x) || std::isnan(uv_src.y);
+      if (uv_src.x < 0)
+      {
+        uv_src.x = 0;
+        outside = true;
+      }
+      if (uv_src.x > w - 1)
+      {
+        uv_src.x = w - 1;
+        outside = true;
+      }
+      if (uv_src.y < 0)
+      {
+        uv_src.y = 0;
+        outside = true;
+      }
+      if (uv_src.y > h - 1)
+      {
+        uv_src.y = h - 1;
+        outside = true;
+      }
+
+      if (outside)
+      {
+        morphMap[i - yl][j - xl].r = 0;
+        morphMap[i - yl][j - xl].g = 0;
+        morphMap[i - yl][j - xl].b = 0;
+        morphMap[i - yl][j - xl].a = 255;
+      }
+      else
+      {
+
+        pixel bilin = bilinear(srcImgMap, uv_src.y, uv_src.x);
+
+        morphMap[i - yl][j - xl].r = bilin.r;
+        morphMap[i - yl][j - xl].g = bilin.g;
+        morphMap[i - yl][j - xl].b = bilin.b;
+        morphMap[i - yl][j - xl].a = bilin.a;
+      }
+    }
+  }
+}
+
+/* Splits the destination rows into blocks that are pulled by the threads of the worker pool. Every pixel only depends
+   on the inputs, so the output is identical to the serial loop. Without pthreads (plain wasm build) the loop runs
+   serial */
+void morphParallel(int yl, int yh, int xl, int xh, int w, int h,
+                   const WarpPlan &plan, int warpMode, const WarpGrid &grid,
+                   const Pixmap &srcImgMap, Pixmap &morphMap)
 {
-  pixel **srcImgMap = pixmapFromVector(w, h, imageData);
+  int nThreads = workerThreads((yh - yl + MORPH_ROW_BLOCK - 1) / MORPH_ROW_BLOCK);
+  if (nThreads <= 1)
+  {
+    morphRows(yl, yh, xl, yl, xh, w, h, plan, warpMode, grid, srcImgMap, morphMap);
+    return;
+  }
 
+  std::atomic<int> nextRow(yl);
+  auto worker = [&]()
+  {
+    for (int row = nextRow.fetch_add(MORPH_ROW_BLOCK); row < yh; row = nextRow.fetch_add(MORPH_ROW_BLOCK))
+      morphRows(row, Min(row + MORPH_ROW_BLOCK, yh), xl, yl, xh, w, h, plan, warpMode, grid, srcImgMap, morphMap);
+  };
+
+  workerPool.run(nThreads, worker);
+}
+
+//--------------------------------------------------------------------------------------------------
+//--------------------------morph-------------------------------------------------------------------
+//--------------------------------------------------------------------------------------------------
+/* sorts the tile outline, transforms it into image space, projects it onto the silhouette of the processed image and
+   traces the silhouette boundary between the projected points.
+   outer: the (subdivided) outline, inner: the corresponding lines on the silhouette boundary */
+void traceOutline(const SilhouetteMask &silhouette,
+                  const DistanceField *field,
+                  const vector<FeatureLine> &skelletonLines,
+                  vector<FeatureLine> &outlineLines,
+                  const vector<double> &M,
+                  vector<FeatureLine> &inner,
+                  vector<FeatureLine> &outer)
+{
   vector<FeatureLine> outlineLinesSorted = sortOutlineLines(outlineLines);
 
-  transformAll(outlineLinesSorted, Minv);
+  transformAll(outlineLinesSorted, M);
 
-  vector<FeatureLine> outlineLinesMorphed = projectOutlineLines(outlineLinesSorted, skelletonLines, srcImgMap, w, h);
+  vector<FeatureLine> outlineLinesMorphed = projectOutlineLines(outlineLinesSorted, skelletonLines, silhouette, field);
 
   removeZeroLengthLines(outlineLinesSorted, outlineLinesMorphed);
 
+  traceBoundary(outlineLinesSorted, outlineLinesMorphed, inner, outer, silhouette);
+}
+
+/* traceOutline for the tiles of a tiling, outline k transformed by matrices[k]. The tiles are pulled by a pool of
+   threads like the rows in morphParallel; tracing only reads the silhouette and the field, so the result is the same as
+   tracing the tiles one after the other */
+void traceOutlines(const SilhouetteMask &silhouette,
+                   const DistanceField *field,
+                   const vector<FeatureLine> &skelletonLines,
+                   vector<vector<FeatureLine>> &outlines,
+                   const vector<vector<double>> &matrices,
+                   vector<vector<FeatureLine>> &inner,
+                   vector<vector<FeatureLine>> &outer)
+{
+  int n = outlines.size();
+  inner.assign(n, vector<FeatureLine>());
+  outer.assign(n, vector<FeatureLine>());
+
+  // an error stops handing out tiles, the pool rethrows it on the caller once every thread is done
+  std::atomic<int> nextTile(0);
+  auto worker = [&]()
+  {
+    for (int k = nextTile++; k < n; k = nextTile++)
+    {
+      try
+      {
+        traceOutline(silhouette, field, skelletonLines, outlines[k], matrices[k], inner[k], outer[k]);
+      }
+      catch (...)
+      {
+        nextTile = n;
+        throw;
+      }
+    }
+  };
+
+  workerPool.run(workerThreads(n), worker);
+}
+
+/* splits the outline lines of all tiles (outlineSizes[k] lines of tile k, one after the other) and the matrices
+   (6 values per tile) */
+void splitTiles(const vector<FeatureLine> &outlineLines, const vector<int> &outlineSizes, const vector<double> &matrices,
+                vector<vector<FeatureLine>> &outlines, vector<vector<double>> &tileMatrices)
+{
+  if (matrices.size() != outlineSizes.size() * 6)
+    throw std::runtime_error("Expected 6 matrix values per tile");
+  outlines.clear();
+  tileMatrices.clear();
+  size_t first = 0;
+  for (int k = 0; k < (int)outlineSizes.size(); k++)
+  {
+    if (outlineSizes[k] < 0 || first + outlineSizes[k] > outlineLines.size())
+      throw std::runtime_error("Outline sizes exceed the outline lines");
+    outlines.push_back(vector<FeatureLine>(outlineLines.begin() + first, outlineLines.begin() + first + outlineSizes[k]));
+    tileMatrices.push_back(vector<double>(matrices.begin() + 6 * k, matrices.begin() + 6 * (k + 1)));
+    first += outlineSizes[k];
+  }
+  if (first != outlineLines.size())
+    throw std::runtime_error("Outline sizes do not cover the outline lines");
+}
+
+vector<FeatureLine> morphOutline(int w, int h, float t,
+                                 const unsigned char *imageDataProcessed, long long processedGeneration,
+                                 const vector<FeatureLine> &skelletonLines,
+                                 vector<FeatureLine> &outlineLines,
+                                 const vector<double> &Minv)
+{
+  int projection = morphProjection;
+  std::shared_ptr<const ProcessedImage> processed = processedImage(w, h, imageDataProcessed, projection, processedGeneration);
+
   vector<FeatureLine> outlineLinestraced_inner;
   vector<FeatureLine> outlineLinestraced_outer;
-  traceBoundary(outlineLinesSorted, outlineLinesMorphed, skelletonLines, outlineLinestraced_inner, outlineLinestraced_outer, srcImgMap, w, h);
+  traceOutline(processed->silhouette, processed->projectionField(projection), skelletonLines, outlineLines, Minv, outlineLinestraced_inner, outlineLinestraced_outer);
 
   vector<FeatureLine> srcLines;
 
@@ -741,13 +1792,64 @@ EMSCRIPTEN_KEEPALIVE vector<FeatureLine> getMorphOutline(int w, int h, float t,
   return srcLines;
 }
 
+EMSCRIPTEN_KEEPALIVE vector<FeatureLine> getMorphOutline(int w, int h, float t,
+                                                         vector<unsigned char> imageData,
+                                                         vector<FeatureLine> skelletonLines,
+                                                         vector<FeatureLine> outlineLines,
+                                                         vector<double> Minv)
+{
+  if (imageData.size() < (size_t)w * h * 4)
+    throw std::runtime_error("Image data smaller than w * h * 4");
+  return morphOutline(w, h, t, imageData.data(), UNCACHED_IMAGE, skelletonLines, outlineLines, Minv);
+}
+
+// getMorphOutline for every tile of a tiling in one call, the tiles are traced in parallel
+MorphOutlines morphOutlines(int w, int h, float t,
+                            const unsigned char *imageDataProcessed, long long processedGeneration,
+                            const vector<FeatureLine> &skelletonLines,
+                            const vector<FeatureLine> &outlineLines,
+                            const vector<int> &outlineSizes,
+                            const vector<double> &Minv)
+{
+  vector<vector<FeatureLine>> outlines;
+  vector<vector<double>> matrices;
+  splitTiles(outlineLines, outlineSizes, Minv, outlines, matrices);
+
+  int projection = morphProjection;
+  std::shared_ptr<const ProcessedImage> processed = processedImage(w, h, imageDataProcessed, projection, processedGeneration);
+
+  vector<vector<FeatureLine>> inner, outer;
+  traceOutlines(processed->silhouette, processed->projectionField(projection), skelletonLines, outlines, matrices, inner, outer);
+
+  MorphOutlines result;
+  for (int k = 0; k < (int)outlines.size(); k++)
+  {
+    size_t first = result.lines.size();
+    lineInterpolate(outer[k], inner[k], result.lines, t);
+    result.sizes.push_back(result.lines.size() - first);
+  }
+  return result;
+}
+
+EMSCRIPTEN_KEEPALIVE MorphOutlines getMorphOutlines(int w, int h, float t,
+                                                    vector<unsigned char> imageData,
+                                                    vector<FeatureLine> skelletonLines,
+                                                    vector<FeatureLine> outlineLines,
+                                                    vector<int> outlineSizes,
+                                                    vector<double> Minv)
+{
+  if (imageData.size() < (size_t)w * h * 4)
+    throw std::runtime_error("Image data smaller than w * h * 4");
+  return morphOutlines(w, h, t, imageData.data(), UNCACHED_IMAGE, skelletonLines, outlineLines, outlineSizes, Minv);
+}
+
 EMSCRIPTEN_KEEPALIVE vector<int> getBBox(vector<FeatureLine> outlineLines, vector<double> matrixVector)
 {
   int xl = std::numeric_limits<int>::max();
   int xh = std::numeric_limits<int>::min();
   int yl = std::numeric_limits<int>::max();
   int yh = std::numeric_limits<int>::min();
-  for (int i = 0; i < outlineLines.size(); i++)
+  for (int i = 0; i < (int)outlineLines.size(); i++)
   {
     Vector2d s = transformPoint(outlineLines[i].startPoint, matrixVector);
     Vector2d e = transformPoint(outlineLines[i].endPoint, matrixVector);
@@ -780,18 +1882,16 @@ EMSCRIPTEN_KEEPALIVE vector<int> getBBox(vector<FeatureLine> outlineLines, vecto
   return result;
 }
 
-EMSCRIPTEN_KEEPALIVE vector<unsigned char> doMorph(int w, int h, float p, float a, float b, float t,
-                                                   vector<unsigned char> imageData,
-                                                   vector<unsigned char> imageDataProcessed,
-                                                   vector<FeatureLine> skelletonLines,
-                                                   vector<FeatureLine> outlineLines,
-                                                   vector<double> matrixVector)
+/* warps the source image along a traced outline into result.bbox (set by the caller), fills result.image and
+   result.outline */
+void warpOutline(int w, int h, float p, float a, float b, float t,
+                 const Pixmap &srcImgMap,
+                 const vector<FeatureLine> &outlineLinestraced_inner,
+                 const vector<FeatureLine> &outlineLinestraced_outer,
+                 int warpMode, float weightCutoff,
+                 MorphResult &result)
 {
-
-  pixel **srcImgMap = pixmapFromVector(w, h, imageData);
-  pixel **srcImgMapProcessed = pixmapFromVector(w, h, imageDataProcessed);
-
-  vector<int> bbox = getBBox(outlineLines, matrixVector);
+  vector<int> &bbox = result.bbox;
   int xl = bbox[0];
   int yl = bbox[1];
   int xh = bbox[2];
@@ -799,20 +1899,7 @@ EMSCRIPTEN_KEEPALIVE vector<unsigned char> doMorph(int w, int h, float p, float
   int w_dest = xh - xl;
   int h_dest = yh - yl;
 
-  pixel **morphMap = allocPixmap(w_dest, h_dest);
-
-  vector<FeatureLine> outlineLinesSorted = sortOutlineLines(outlineLines);
-
-  transformAll(outlineLinesSorted, matrixVector);
-  transformAll(outlineLines, matrixVector);
-
-  vector<FeatureLine> outlineLinesMorphed = projectOutlineLines(outlineLinesSorted, skelletonLines, srcImgMapProcessed, w, h);
-
-  removeZeroLengthLines(outlineLinesSorted, outlineLinesMorphed);
-  
-  vector<FeatureLine> outlineLinestraced_inner;
-  vector<FeatureLine> outlineLinestraced_outer;
-  traceBoundary(outlineLinesSorted, outlineLinesMorphed, skelletonLines, outlineLinestraced_inner, outlineLinestraced_outer, srcImgMapProcessed, w, h);
+  Pixmap morphMap(w_dest, h_dest);
 
   // the featureline of sourceImage, destImage and the morphImage
   vector<FeatureLine> srcLines;
@@ -824,73 +1911,454 @@ EMSCRIPTEN_KEEPALIVE vector<unsigned char> doMorph(int w, int h, float p, float
   dstLines.insert(dstLines.end(), outlineLinestraced_outer.begin(), outlineLinestraced_outer.end());
   lineInterpolate(outlineLinestraced_outer, outlineLinestraced_inner, srcLines, t);
 
-  Vector2d uv_src;
-  Vector2d uv_dst;
-  pixel interColor;
+  WarpPlan plan = buildWarpPlan(srcLines, dstLines, p, a, b);
+  WarpGrid grid;
+  if (warpMode == WARP_GRID)
+    grid = buildWarpGrid(plan, dstLines, xl, yl, xh, yh, weightCutoff);
 
-  for (int i = yl; i < yh; i++)
-  {
-    for (int j = xl; j < xh; j++)
-    {
-      uv_dst.x = j;
-      uv_dst.y = i;
+  morphParallel(yl, yh, xl, xh, w, h, plan, warpMode, grid, srcImgMap, morphMap);
 
-      // warping
-      warp(uv_dst, srcLines, dstLines, p, a, b, uv_src);
+  result.image.resize((size_t)morphMap.width() * morphMap.height() * sizeof(pixel));
+  morphMap.copyTo(result.image.data());
+  result.outline = srcLines;
+}
 
-      bool outside = false;
-      if (uv_src.x < 0)
-      {
-        uv_src.x = 0;
-        outside = true;
-      }
-      if (uv_src.x > w - 1)
-      {
-        uv_src.x = w - 1;
-        outside = true;
-      }
-      if (uv_src.y < 0)
-      {
-        uv_src.y = 0;
-        outside = true;
-      }
-      if (uv_src.y > h - 1)
-      {
-        uv_src.y = h - 1;
-        outside = true;
-      }
+/* the morph pipeline on raw RGBA buffers of w*h pixels
+   warpMode: WARP_EXACT or WARP_GRID, weightCutoff: relative weight in [0, 1) below which lines are skipped in WARP_GRID
+   mode */
+void morphBuffer(int w, int h, float p, float a, float b, float t,
+                 const unsigned char *imageData,
+                 const unsigned char *imageDataProcessed, long long processedGeneration,
+                 const vector<FeatureLine> &skelletonLines,
+                 vector<FeatureLine> &outlineLines,
+                 const vector<double> &matrixVector,
+                 int warpMode, float weightCutoff,
+                 MorphResult &result)
+{
 
-      if (outside)
-      {
-        morphMap[i - yl][j - xl].r = 0;
-        morphMap[i - yl][j - xl].g = 0;
-        morphMap[i - yl][j - xl].b = 0;
-        morphMap[i - yl][j - xl].a = 255;
-      }
-      else
-      {
+  if (outlineLines.empty())
+    throw std::runtime_error("Empty outline");
+  checkWarpMode(warpMode);
+  checkWeightCutoff(weightCutoff);
 
-        pixel bilin = bilinear(srcImgMap, uv_src.y, uv_src.x);
+  Pixmap srcImgMap(w, h, imageData);
+  int projection = morphProjection;
+  std::shared_ptr<const ProcessedImage> processed = processedImage(w, h, imageDataProcessed, projection, processedGeneration);
+  result.bbox = getBBox(outlineLines, matrixVector);
 
-        morphMap[i - yl][j - xl].r = bilin.r;
-        morphMap[i - yl][j - xl].g = bilin.g;
-        morphMap[i - yl][j - xl].b = bilin.b;
-        morphMap[i - yl][j - xl].a = bilin.a;
-      }
-    }
-  }
+  vector<FeatureLine> outlineLinestraced_inner;
+  vector<FeatureLine> outlineLinestraced_outer;
+  traceOutline(processed->silhouette, processed->projectionField(projection), skelletonLines, outlineLines, matrixVector, outlineLinestraced_inner, outlineLinestraced_outer);
 
-  vector<unsigned char> result = vectorFromPixmap(w_dest, h_dest, morphMap);
+  warpOutline(w, h, p, a, b, t, srcImgMap, outlineLinestraced_inner, outlineLinestraced_outer, warpMode, weightCutoff, result);
+}
 
-  // clear the previous pixmap
-  delete[] srcImgMap;
-  delete[] srcImgMapProcessed;
-  delete[] morphMap;
+// warpMode: WARP_EXACT or WARP_GRID, weightCutoff: relative weight in [0, 1) below which lines are skipped in WARP_GRID mode
+EMSCRIPTEN_KEEPALIVE vector<unsigned char> doMorph(int w, int h, float p, float a, float b, float t,
+                                                   vector<unsigned char> imageData,
+                                                   vector<unsigned char> imageDataProcessed,
+                                                   vector<FeatureLine> skelletonLines,
+                                                   vector<FeatureLine> outlineLines,
+                                                   vector<double> matrixVector,
+                                                   int warpMode, float weightCutoff)
+{
+  if (imageData.size() < (size_t)w * h * 4 || imageDataProcessed.size() < (size_t)w * h * 4)
+    throw std::runtime_error("Image data smaller than w * h * 4");
+
+  MorphResult result;
+  morphBuffer(w, h, p, a, b, t, imageData.data(), imageDataProcessed.data(), UNCACHED_IMAGE, skelletonLines, outlineLines, matrixVector, warpMode, weightCutoff, result);
+  return result.image;
+}
 
+EMSCRIPTEN_KEEPALIVE vector<unsigned char> doMorph(int w, int h, float p, float a, float b, float t,
+                                                   vector<unsigned char> imageData,
+                                                   vector<unsigned char> imageDataProcessed,
+                                                   vector<FeatureLine> skelletonLines,
+                                                   vector<FeatureLine> outlineLines,
+                                                   vector<double> matrixVector)
+{
+  return doMorph(w, h, p, a, b, t, imageData, imageDataProcessed, skelletonLines, outlineLines, matrixVector, WARP_EXACT, 0);
+}
+
+// doMorph, getMorphOutline and getBBox in one pass
+EMSCRIPTEN_KEEPALIVE MorphResult doMorphWithOutline(int w, int h, float p, float a, float b, float t,
+                                                    vector<unsigned char> imageData,
+                                                    vector<unsigned char> imageDataProcessed,
+                                                    vector<FeatureLine> skelletonLines,
+                                                    vector<FeatureLine> outlineLines,
+                                                    vector<double> matrixVector,
+                                                    int warpMode, float weightCutoff)
+{
+  if (imageData.size() < (size_t)w * h * 4 || imageDataProcessed.size() < (size_t)w * h * 4)
+    throw std::runtime_error("Image data smaller than w * h * 4");
+
+  MorphResult result;
+  morphBuffer(w, h, p, a, b, t, imageData.data(), imageDataProcessed.data(), UNCACHED_IMAGE, skelletonLines, outlineLines, matrixVector, warpMode, weightCutoff, result);
   return result;
 }
 
+/* morphBuffer for several jobs on the same images, e.g. the tile aspects of a tiling: outlineSizes[k] outline lines
+   and 6 matrix values per job. The pixmap and the silhouette are built once for all jobs, the outlines are traced
+   and warped in parallel (setMorphThreads) */
+void morphBatch(int w, int h, float p, float a, float b, float t,
+                const unsigned char *imageData,
+                const unsigned char *imageDataProcessed, long long processedGeneration,
+                const vector<FeatureLine> &skelletonLines,
+                const vector<FeatureLine> &outlineLines,
+                const vector<int> &outlineSizes,
+                const vector<double> &matrixVector,
+                int warpMode, float weightCutoff,
+                vector<MorphResult> &results)
+{
+  checkWarpMode(warpMode);
+  checkWeightCutoff(weightCutoff);
+  vector<vector<FeatureLine>> outlines;
+  vector<vector<double>> matrices;
+  splitTiles(outlineLines, outlineSizes, matrixVector, outlines, matrices);
+
+  int n = outlines.size();
+  results.assign(n, MorphResult());
+  for (int k = 0; k < n; k++)
+  {
+    if (outlines[k].empty())
+      throw std::runtime_error("Empty outline");
+    results[k].bbox = getBBox(outlines[k], matrices[k]);
+  }
+
+  Pixmap srcImgMap(w, h, imageData);
+  int projection = morphProjection;
+  std::shared_ptr<const ProcessedImage> processed = processedImage(w, h, imageDataProcessed, projection, processedGeneration);
+
+  vector<vector<FeatureLine>> inner, outer;
+  traceOutlines(processed->silhouette, processed->projectionField(projection), skelletonLines, outlines, matrices, inner, outer);
+
+  // fewer jobs than threads are warped one after the other, each on all threads. Otherwise every job is warped on
+  // one thread (morphParallel runs inline inside of a pool job), the small jobs of a tiling don't split into rows well
+  if (workerThreads(n) < workerThreads(n + 1))
+  {
+    for (int k = 0; k < n; k++)
+      warpOutline(w, h, p, a, b, t, srcImgMap, inner[k], outer[k], warpMode, weightCutoff, results[k]);
+    return;
+  }
+
+  std::atomic<int> nextJob(0);
+  auto worker = [&]()
+  {
+    for (int k = nextJob++; k < n; k = nextJob++)
+      warpOutline(w, h, p, a, b, t, srcImgMap, inner[k], outer[k], warpMode, weightCutoff, results[k]);
+  };
+  workerPool.run(workerThreads(n), worker);
+}
+
+// doMorphWithOutline for every job, the images are passed once
+EMSCRIPTEN_KEEPALIVE vector<MorphResult> doMorphBatch(int w, int h, float p, float a, float b, float t,
+                                                      vector<unsigned char> imageData,
+                                                      vector<unsigned char> imageDataProcessed,
+                                                      vector<FeatureLine> skelletonLines,
+                                                      vector<FeatureLine> outlineLines,
+                                                      vector<int> outlineSizes,
+                                                      vector<double> matrixVector,
+                                                      int warpMode, float weightCutoff)
+{
+  if (imageData.size() < (size_t)w * h * 4 || imageDataProcessed.size() < (size_t)w * h * 4)
+    throw std::runtime_error("Image data smaller than w * h * 4");
+
+  vector<MorphResult> results;
+  morphBatch(w, h, p, a, b, t, imageData.data(), imageDataProcessed.data(), UNCACHED_IMAGE, skelletonLines, outlineLines, outlineSizes,
+             matrixVector, warpMode, weightCutoff, results);
+  return results;
+}
+
+//--------------------------------------------------------------------------------------------------
+//--------------------------buffer api--------------------------------------------------------------
+//--------------------------------------------------------------------------------------------------
+/* Zero copy variant of doMorph / getMorphOutline. Javascript writes the images directly into the wasm heap:
+     getImageBuffer(IMAGE_BUFFER, w * h * 4).set(imageData.data);
+     getImageBuffer(IMAGE_PROCESSED_BUFFER, w * h * 4).set(imageDataProcessed.data);
+     morphedImageData.data.set(doMorphBuffer(w, h, ...));
+   The returned views point into the wasm memory, they are only valid until the next call (or memory growth). The
+   silhouette and distance field of the processed image are kept until the next getImageBuffer(IMAGE_PROCESSED_BUFFER)
+   call, a changed image has to be written through a new view.
+   The buffers and morphOutput are globals without a lock: the buffer api has one caller at a time (the javascript
+   thread of the module). Concurrent callers use a MorphSession each */
+vector<unsigned char> imageBuffers[2];
+long long imageBufferGenerations[2] = {0, 0}; // changes with every imageBuffer call, keys the processed image cache
+long long nextImageBufferGeneration = 1;
+MorphResult morphOutput; // result of the last doMorphBuffer call
+
+// the buffer slot resized to size bytes, for the caller to write the image into
+unsigned char *imageBuffer(int slot, int size)
+{
+  if (slot != IMAGE_BUFFER && slot != IMAGE_PROCESSED_BUFFER)
+    throw std::runtime_error("Invalid image buffer");
+  imageBuffers[slot].resize(size);
+  imageBufferGenerations[slot] = nextImageBufferGeneration++;
+  return imageBuffers[slot].data();
+}
+
+const unsigned char *imageBufferData(int slot, int w, int h)
+{
+  if (imageBuffers[slot].size() < (size_t)w * h * 4)
+    throw std::runtime_error("Image buffer smaller than w * h * 4");
+  return imageBuffers[slot].data();
+}
+
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE val getImageBuffer(int slot, int size)
+{
+  unsigned char *data = imageBuffer(slot, size);
+  return val(typed_memory_view(imageBuffers[slot].size(), data));
+}
+
+EMSCRIPTEN_KEEPALIVE val doMorphBuffer(int w, int h, float p, float a, float b, float t,
+                                       vector<FeatureLine> skelletonLines,
+                                       vector<FeatureLine> outlineLines,
+                                       vector<double> matrixVector,
+                                       int warpMode, float weightCutoff)
+{
+  morphBuffer(w, h, p, a, b, t, imageBufferData(IMAGE_BUFFER, w, h), imageBufferData(IMAGE_PROCESSED_BUFFER, w, h),
+              imageBufferGenerations[IMAGE_PROCESSED_BUFFER],
+              skelletonLines, outlineLines, matrixVector, warpMode, weightCutoff, morphOutput);
+  return val(typed_memory_view(morphOutput.image.size(), morphOutput.image.data()));
+}
+#endif
+
+// outline and bbox computed by the last doMorphBuffer call
+EMSCRIPTEN_KEEPALIVE vector<FeatureLine> getLastMorphOutline()
+{
+  return morphOutput.outline;
+}
+
+EMSCRIPTEN_KEEPALIVE vector<int> getLastMorphBBox()
+{
+  return morphOutput.bbox;
+}
+
+// doMorphBatch on the images in the buffers
+EMSCRIPTEN_KEEPALIVE vector<MorphResult> doMorphBatchBuffer(int w, int h, float p, float a, float b, float t,
+                                                            vector<FeatureLine> skelletonLines,
+                                                            vector<FeatureLine> outlineLines,
+                                                            vector<int> outlineSizes,
+                                                            vector<double> matrixVector,
+                                                            int warpMode, float weightCutoff)
+{
+  vector<MorphResult> results;
+  morphBatch(w, h, p, a, b, t, imageBufferData(IMAGE_BUFFER, w, h), imageBufferData(IMAGE_PROCESSED_BUFFER, w, h),
+             imageBufferGenerations[IMAGE_PROCESSED_BUFFER],
+             skelletonLines, outlineLines, outlineSizes, matrixVector, warpMode, weightCutoff, results);
+  return results;
+}
+
+EMSCRIPTEN_KEEPALIVE vector<FeatureLine> getMorphOutlineBuffer(int w, int h, float t,
+                                                               vector<FeatureLine> skelletonLines,
+                                                               vector<FeatureLine> outlineLines,
+                                                               vector<double> Minv)
+{
+  return morphOutline(w, h, t, imageBufferData(IMAGE_PROCESSED_BUFFER, w, h),
+              imageBufferGenerations[IMAGE_PROCESSED_BUFFER], skelletonLines, outlineLines, Minv);
+}
+
+//--------------------------------------------------------------------------------------------------
+//--------------------------morph session-----------------------------------------------------------
+//--------------------------------------------------------------------------------------------------
+/* Keeps the decoded images and the results of every pipeline stage between calls, so a slider change only
+   re-runs the stages whose inputs changed:
+     images                   -> pixmaps
+     skelleton, outline, M    -> traced outline (sort, project, trace), bbox
+     t                        -> interpolated lines
+     p, a, b, warpMode        -> warp plan and grid
+   morph() runs the invalid stages and the warp.
+   A session shares only the worker pool (one run at a time) and the setMorph* settings with other sessions, each
+   thread can use its own. A single session has one caller at a time */
+class MorphSession
+{
+public:
+  MorphSession()
+      : w(0), h(0), t(0), p(0), a(0), b(0), warpMode(WARP_EXACT), weightCutoff(0),
+        projection(PROJECT_SEARCH), outlineValid(false), linesValid(false), planValid(false), outputValid(false)
+  {
+  }
+
+  // the image buffers are filled from javascript, setImages(w, h) has to be called afterwards
+  vector<unsigned char> &imageBuffer(int slot, int size)
+  {
+    if (slot != IMAGE_BUFFER && slot != IMAGE_PROCESSED_BUFFER)
+      throw std::runtime_error("Invalid image buffer");
+    buffers[slot].resize(size);
+    return buffers[slot];
+  }
+
+  void setImages(int w, int h)
+  {
+    if (buffers[IMAGE_BUFFER].size() < (size_t)w * h * 4 || buffers[IMAGE_PROCESSED_BUFFER].size() < (size_t)w * h * 4)
+      throw std::runtime_error("Image buffer smaller than w * h * 4");
+    this->w = w;
+    this->h = h;
+    srcImgMap = Pixmap(w, h, buffers[IMAGE_BUFFER].data());
+    silhouette = SilhouetteMask(w, h, buffers[IMAGE_PROCESSED_BUFFER].data());
+    field = DistanceField();
+    outlineValid = false;
+  }
+
+  void setOutline(vector<FeatureLine> skelletonLines, vector<FeatureLine> outlineLines, vector<double> matrixVector)
+  {
+    if (outlineValid && equalLines(skelletonLines, this->skelletonLines) && equalLines(outlineLines, this->outlineLines) && matrixVector == this->matrixVector)
+      return;
+    this->skelletonLines = skelletonLines;
+    this->outlineLines = outlineLines;
+    this->matrixVector = matrixVector;
+    outlineValid = false;
+  }
+
+  void setT(float t)
+  {
+    if (t == this->t)
+      return;
+    this->t = t;
+    linesValid = false;
+  }
+
+  void setWarpParameters(float p, float a, float b, int warpMode, float weightCutoff)
+  {
+    checkWarpMode(warpMode);
+    checkWeightCutoff(weightCutoff);
+    if (p == this->p && a == this->a && b == this->b && warpMode == this->warpMode && weightCutoff == this->weightCutoff)
+      return;
+    this->p = p;
+    this->a = a;
+    this->b = b;
+    this->warpMode = warpMode;
+    this->weightCutoff = weightCutoff;
+    planValid = false;
+  }
+
+  vector<int> getBBox()
+  {
+    update(false);
+    return bbox;
+  }
+
+  // the interpolated outline (same as getMorphOutline)
+  vector<FeatureLine> getOutline()
+  {
+    update(false);
+    return srcLines;
+  }
+
+  // the morphed image of the outline bbox, valid until the next call
+  const vector<unsigned char> &morphImage()
+  {
+    update(true);
+    return output;
+  }
+
+#ifdef __EMSCRIPTEN__
+  val getImageBuffer(int slot, int size)
+  {
+    vector<unsigned char> &buffer = imageBuffer(slot, size);
+    return val(typed_memory_view(buffer.size(), buffer.data()));
+  }
+
+  val morph()
+  {
+    const vector<unsigned char> &image = morphImage();
+    return val(typed_memory_view(image.size(), image.data()));
+  }
+#endif
+
+private:
+  int w, h;
+  float t, p, a, b;
+  int warpMode;
+  float weightCutoff;
+
+  vector<unsigned char> buffers[2];
+  Pixmap srcImgMap;
+  SilhouetteMask silhouette; // of the processed image
+  DistanceField field;       // of silhouette, built on the first PROJECT_NEAREST update
+  int projection;      // morphProjection of the traced outline
+
+  vector<FeatureLine> skelletonLines, outlineLines;
+  vector<double> matrixVector;
+
+  // stage results
+  vector<FeatureLine> inner, outer;
+  vector<int> bbox;
+  vector<FeatureLine> srcLines;
+  WarpPlan plan;
+  WarpGrid grid;
+  vector<unsigned char> output;
+
+  bool outlineValid, linesValid, planValid, outputValid;
+
+  static bool equalLines(const vector<FeatureLine> &l1, const vector<FeatureLine> &l2)
+  {
+    if (l1.size() != l2.size())
+      return false;
+    for (int i = 0; i < (int)l1.size(); i++)
+    {
+      if (!(l1[i].startPoint == l2[i].startPoint) || !(l1[i].endPoint == l2[i].endPoint))
+        return false;
+    }
+    return true;
+  }
+
+  void update(bool warpImage)
+  {
+    if (srcImgMap.empty())
+      throw std::runtime_error("No images set");
+    if (outlineLines.empty())
+      throw std::runtime_error("Empty outline");
+
+    if (projection != morphProjection)
+    {
+      projection = morphProjection;
+      outlineValid = false;
+    }
+    if (!outlineValid)
+    {
+      inner.clear();
+      outer.clear();
+      vector<FeatureLine> lines = outlineLines;
+      bbox = ::getBBox(lines, matrixVector);
+      if (projection == PROJECT_NEAREST && field.empty())
+        field = DistanceField(silhouette);
+      traceOutline(silhouette, projection == PROJECT_NEAREST ? &field : NULL, skelletonLines, lines, matrixVector, inner, outer);
+      outlineValid = true;
+      linesValid = false;
+    }
+    if (!linesValid)
+    {
+      srcLines.clear();
+      lineInterpolate(outer, inner, srcLines, t);
+      linesValid = true;
+      planValid = false;
+    }
+    if (!warpImage)
+      return;
+    if (!planValid)
+    {
+      plan = buildWarpPlan(srcLines, outer, p, a, b);
+      if (warpMode == WARP_GRID)
+        grid = buildWarpGrid(plan, outer, bbox[0], bbox[1], bbox[2], bbox[3], weightCutoff);
+      planValid = true;
+      outputValid = false;
+    }
+    if (!outputValid)
+    {
+      int w_dest = bbox[2] - bbox[0];
+      int h_dest = bbox[3] - bbox[1];
+      Pixmap morphMap(w_dest, h_dest);
+      morphParallel(bbox[1], bbox[3], bbox[0], bbox[2], w, h, plan, warpMode, grid, srcImgMap, morphMap);
+      output.resize((size_t)morphMap.width() * morphMap.height() * sizeof(pixel));
+      morphMap.copyTo(output.data());
+      outputValid = true;
+    }
+  }
+};
+
 // Binding code
+#ifdef __EMSCRIPTEN__
 EMSCRIPTEN_BINDINGS(myvoronoi)
 {
   register_vector<unsigned char>("VectorByte");
@@ -906,7 +2374,58 @@ EMSCRIPTEN_BINDINGS(myvoronoi)
       .field("startPoint", &FeatureLine::startPoint)
       .field("endPoint", &FeatureLine::endPoint);
 
-  emscripten::function("doMorph", &doMorph);
+  typedef vector<unsigned char> (*DoMorphExact)(int, int, float, float, float, float,
+                                                vector<unsigned char>, vector<unsigned char>,
+                                                vector<FeatureLine>, vector<FeatureLine>, vector<double>);
+  typedef vector<unsigned char> (*DoMorphMode)(int, int, float, float, float, float,
+                                               vector<unsigned char>, vector<unsigned char>,
+                                               vector<FeatureLine>, vector<FeatureLine>, vector<double>,
+                                               int, float);
+
+  // overloaded by number of arguments: doMorph(..., matrix) is the exact warp, doMorph(..., matrix, warpMode, weightCutoff) selects the mode
+  emscripten::function("doMorph", (DoMorphExact)&doMorph);
+  emscripten::function("doMorph", (DoMorphMode)&doMorph);
+  constant("WARP_EXACT", WARP_EXACT);
+  constant("WARP_GRID", WARP_GRID);
   emscripten::function("getMorphOutline", &getMorphOutline);
+
+  value_object<MorphOutlines>("MorphOutlines")
+      .field("lines", &MorphOutlines::lines)
+      .field("sizes", &MorphOutlines::sizes);
+  emscripten::function("getMorphOutlines", &getMorphOutlines);
+
+  value_object<MorphResult>("MorphResult")
+      .field("image", &MorphResult::image)
+      .field("outline", &MorphResult::outline)
+      .field("bbox", &MorphResult::bbox);
+  emscripten::function("doMorphWithOutline", &doMorphWithOutline);
+  register_vector<MorphResult>("VectorMorphResult");
+  emscripten::function("doMorphBatch", &doMorphBatch);
   emscripten::function("getBBox", &getBBox);
+  emscripten::function("getImageBuffer", &getImageBuffer);
+  emscripten::function("doMorphBuffer", &doMorphBuffer);
+  emscripten::function("getMorphOutlineBuffer", &getMorphOutlineBuffer);
+  emscripten::function("doMorphBatchBuffer", &doMorphBatchBuffer);
+  emscripten::function("getLastMorphOutline", &getLastMorphOutline);
+  emscripten::function("getLastMorphBBox", &getLastMorphBBox);
+  constant("IMAGE_BUFFER", IMAGE_BUFFER);
+
+  class_<MorphSession>("MorphSession")
+      .constructor<>()
+      .function("getImageBuffer", &MorphSession::getImageBuffer)
+      .function("setImages", &MorphSession::setImages)
+      .function("setOutline", &MorphSession::setOutline)
+      .function("setT", &MorphSession::setT)
+      .function("setWarpParameters", &MorphSession::setWarpParameters)
+      .function("getBBox", &MorphSession::getBBox)
+      .function("getOutline", &MorphSession::getOutline)
+      .function("morph", &MorphSession::morph);
+
+  constant("IMAGE_PROCESSED_BUFFER", IMAGE_PROCESSED_BUFFER);
+  emscripten::function("setMorphThreads", &setMorphThreads);
+  emscripten::function("setMorphSimd", &setMorphSimd);
+  emscripten::function("setMorphProjection", &setMorphProjection);
+  constant("PROJECT_SEARCH", PROJECT_SEARCH);
+  constant("PROJECT_NEAREST", PROJECT_NEAREST);
 }
+#endif
@@ -0,0 +1,107 @@
+#ifndef _H_MORPH
+#define _H_MORPH
+
+#include "geometricTool.h"
+#include <vector>
+
+// warp modes selectable from javascript
+#define WARP_EXACT 0 // evaluate every feature line for every pixel (reference)
+#define WARP_GRID  1 // evaluate only the lines stored in the grid cell of the pixel
+
+// projection of the outline onto the silhouette selectable from javascript (setMorphProjection)
+#define PROJECT_SEARCH  0 // search along the line to the closest skelleton end point (reference)
+#define PROJECT_NEAREST 1 // nearest silhouette pixel, O(1) lookups in a distance field built once per image. Not a
+                          // speedup: building the field costs more than the searches, it only pays off when the field
+                          // is reused (MorphSession, buffer api) and the searches are long
+
+struct MorphResult
+{
+  std::vector<unsigned char> image; // RGBA image of the bbox
+  std::vector<FeatureLine> outline; // interpolated outline (same as getMorphOutline)
+  std::vector<int> bbox;            // xl, yl, xh, yh (same as getBBox)
+};
+
+// outlines of several tiles, sizes[k] lines of tile k one after the other
+struct MorphOutlines
+{
+  std::vector<FeatureLine> lines;
+  std::vector<int> sizes;
+};
+
+std::vector<unsigned char> doMorph(int w, int h, float p, float a, float b, float t,
+                                   std::vector<unsigned char> imageData,
+                                   std::vector<unsigned char> imageDataProcessed,
+                                   std::vector<FeatureLine> skelletonLines,
+                                   std::vector<FeatureLine> outlineLines,
+                                   std::vector<double> matrixVector,
+                                   int warpMode, float weightCutoff);
+
+std::vector<unsigned char> doMorph(int w, int h, float p, float a, float b, float t,
+                                   std::vector<unsigned char> imageData,
+                                   std::vector<unsigned char> imageDataProcessed,
+                                   std::vector<FeatureLine> skelletonLines,
+                                   std::vector<FeatureLine> outlineLines,
+                                   std::vector<double> matrixVector);
+
+MorphResult doMorphWithOutline(int w, int h, float p, float a, float b, float t,
+                               std::vector<unsigned char> imageData,
+                               std::vector<unsigned char> imageDataProcessed,
+                               std::vector<FeatureLine> skelletonLines,
+                               std::vector<FeatureLine> outlineLines,
+                               std::vector<double> matrixVector,
+                               int warpMode, float weightCutoff);
+
+/* doMorphWithOutline for several jobs on the same images: outlineSizes[k] outline lines and 6 values of matrixVector
+   per job, one result per job */
+std::vector<MorphResult> doMorphBatch(int w, int h, float p, float a, float b, float t,
+                                      std::vector<unsigned char> imageData,
+                                      std::vector<unsigned char> imageDataProcessed,
+                                      std::vector<FeatureLine> skelletonLines,
+                                      std::vector<FeatureLine> outlineLines,
+                                      std::vector<int> outlineSizes,
+                                      std::vector<double> matrixVector,
+                                      int warpMode, float weightCutoff);
+
+std::vector<FeatureLine> getMorphOutline(int w, int h, float t,
+                                         std::vector<unsigned char> imageDataProcessed,
+                                         std::vector<FeatureLine> skelletonLines,
+                                         std::vector<FeatureLine> outlineLines,
+                                         std::vector<double> Minv);
+
+// getMorphOutline for every tile: outlineSizes[k] outline lines and 6 values of Minv per tile, traced in parallel
+MorphOutlines getMorphOutlines(int w, int h, float t,
+                               std::vector<unsigned char> imageDataProcessed,
+                               std::vector<FeatureLine> skelletonLines,
+                               std::vector<FeatureLine> outlineLines,
+                               std::vector<int> outlineSizes,
+                               std::vector<double> Minv);
+
+std::vector<int> getBBox(std::vector<FeatureLine> outlineLines, std::vector<double> matrixVector);
+
+// buffer api (see morph.cpp): the images are written into the buffer slots, the processed image is cached per write.
+// The slots are global, one caller at a time
+#define IMAGE_BUFFER 0
+#define IMAGE_PROCESSED_BUFFER 1
+
+unsigned char *imageBuffer(int slot, int size);
+
+std::vector<FeatureLine> getMorphOutlineBuffer(int w, int h, float t,
+                                               std::vector<FeatureLine> skelletonLines,
+                                               std::vector<FeatureLine> outlineLines,
+                                               std::vector<double> Minv);
+
+// chains outline lines to loops (closed[k]) or open chains, linear in the number of lines
+std::vector<std::vector<FeatureLine>> assembleOutlineLoops(const std::vector<FeatureLine> &lines, float tolerance,
+                                                           std::vector<bool> &closed);
+
+// total iterations of the silhouette border searches so far (profiling)
+long long getSearchIterations();
+
+// outline lines so far whose silhouette boundary could not be traced, they are left out of the morph (diagnostics)
+long long getBadLoops();
+
+void setMorphThreads(int n);
+void setMorphSimd(bool enabled);
+void setMorphProjection(int mode);
+
+#endif
@@ -0,0 +1,798 @@
+// Checks of the morph entry points on a synthetic image, run by ctest (native build only). morph.cpp is included
+// so its internal classes can be checked against brute force references
+#include "morph.cpp"
+#include <cstdio>
+#include <string>
+#include <filesystem>
+#include <cmath>
+#include <vector>
+#include <stdexcept>
+#include <cstdlib>
+
+#ifdef HAVE_PNG
+#include <png.h>
+#endif
+
+using namespace std;
+
+int failures = 0;
+
+#define CHECK(cond)                                                   \
+  do                                                                  \
+  {                                                                   \
+    if (!(cond))                                                      \
+    {                                                                 \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                     \
+    }                                                                 \
+  } while (0)
+
+// f throws a std::runtime_error (and nothing else)
+template <typename F>
+bool throwsRuntimeError(F f)
+{
+  try
+  {
+    f();
+  }
+  catch (const std::runtime_error &)
+  {
+    return true;
+  }
+  return false;
+}
+
+// white disc on black, a skelleton cross and a square outline around it
+struct TestInput
+{
+  int w, h;
+  vector<unsigned char> image, processed;
+  vector<FeatureLine> skelleton, outline;
+  vector<double> M;
+};
+
+TestInput makeInput(int w, int h, double radius = 0.35)
+{
+  TestInput in;
+  in.w = w;
+  in.h = h;
+  in.image.resize((size_t)w * h * 4);
+  in.processed.resize((size_t)w * h * 4);
+  double cx = w / 2, cy = h / 2, r = radius * Min(w, h);
+  for (int y = 0; y < h; y++)
+    for (int x = 0; x < w; x++)
+    {
+      size_t i = ((size_t)y * w + x) * 4;
+      unsigned char v = (x - cx) * (x - cx) + (y - cy) * (y - cy) < r * r ? 255 : 0;
+      in.processed[i] = in.processed[i + 1] = in.processed[i + 2] = v;
+      in.processed[i + 3] = 255;
+      in.image[i] = x;
+      in.image[i + 1] = y;
+      in.image[i + 2] = x + y;
+      in.image[i + 3] = 255;
+    }
+
+  double s = 0.4 * r;
+  in.skelleton.push_back(FeatureLine(Point(Vector2d(cx - s, cy)), Point(Vector2d(cx + s, cy))));
+  in.skelleton.push_back(FeatureLine(Point(Vector2d(cx, cy - s)), Point(Vector2d(cx, cy + s))));
+
+  vector<Vector2d> pts;
+  int lo_x = 0.1 * w, hi_x = 0.9 * w, lo_y = 0.1 * h, hi_y = 0.9 * h;
+  for (int x = lo_x; x < hi_x; x += 8)
+    pts.push_back(Vector2d(x, lo_y));
+  for (int y = lo_y; y < hi_y; y += 8)
+    pts.push_back(Vector2d(hi_x, y));
+  for (int x = hi_x; x > lo_x; x -= 8)
+    pts.push_back(Vector2d(x, hi_y));
+  for (int y = hi_y; y > lo_y; y -= 8)
+    pts.push_back(Vector2d(lo_x, y));
+  for (size_t i = 0; i < pts.size(); i++)
+    in.outline.push_back(FeatureLine(Point(pts[i]), Point(pts[(i + 1) % pts.size()])));
+
+  double M[] = {1, 0, 0, 1, 0, 0};
+  in.M.assign(M, M + 6);
+  return in;
+}
+
+// the outline of in for n tiles, shifted by a pixel against each other
+void tileJobs(const TestInput &in, int n, vector<FeatureLine> &outlines, vector<int> &sizes, vector<double> &matrices)
+{
+  for (int k = 0; k < n; k++)
+  {
+    outlines.insert(outlines.end(), in.outline.begin(), in.outline.end());
+    sizes.push_back(in.outline.size());
+    double M[] = {1, 0, 0, 1, (double)k, (double)-k};
+    matrices.insert(matrices.end(), M, M + 6);
+  }
+}
+
+// an error while tracing one tile comes back as an exception with any number of threads
+void testTracingErrors()
+{
+  TestInput in = makeInput(64, 64);
+  vector<FeatureLine> outlines;
+  vector<int> sizes;
+  vector<double> matrices;
+  tileJobs(in, 8, outlines, sizes, matrices);
+  vector<FeatureLine> noSkelleton;
+
+  int threads[] = {1, 4};
+  for (int i = 0; i < 2; i++)
+  {
+    setMorphThreads(threads[i]);
+    CHECK(throwsRuntimeError([&]()
+                             { getMorphOutlines(in.w, in.h, 0.5, in.processed, noSkelleton, outlines, sizes, matrices); }));
+    MorphOutlines result = getMorphOutlines(in.w, in.h, 0.5, in.processed, in.skelleton, outlines, sizes, matrices);
+    CHECK(result.sizes.size() == 8);
+  }
+  setMorphThreads(0);
+}
+
+// a batch with one invalid job outline fails as a whole with an exception, valid batches give a result per job
+void testBatchErrors()
+{
+  TestInput in = makeInput(64, 64);
+  vector<FeatureLine> outlines;
+  vector<int> sizes;
+  vector<double> matrices;
+  tileJobs(in, 3, outlines, sizes, matrices);
+
+  // job 1 without its last line is an open chain
+  vector<FeatureLine> broken = outlines;
+  broken.erase(broken.begin() + 2 * in.outline.size() - 1);
+  vector<int> brokenSizes = sizes;
+  brokenSizes[1]--;
+
+  int threads[] = {1, 4};
+  for (int i = 0; i < 2; i++)
+  {
+    setMorphThreads(threads[i]);
+    CHECK(throwsRuntimeError([&]()
+                             { doMorphBatch(in.w, in.h, 0, 1, 2, 0.5, in.image, in.processed, in.skelleton, broken, brokenSizes, matrices,
+                                            WARP_GRID, 0.1f); }));
+    vector<MorphResult> results = doMorphBatch(in.w, in.h, 0, 1, 2, 0.5, in.image, in.processed, in.skelleton, outlines, sizes, matrices,
+                                               WARP_GRID, 0.1f);
+    CHECK(results.size() == 3);
+    for (size_t k = 0; k < results.size(); k++)
+      CHECK(results[k].image.size() == (size_t)(results[k].bbox[2] - results[k].bbox[0]) * (results[k].bbox[3] - results[k].bbox[1]) * 4);
+  }
+  setMorphThreads(0);
+}
+
+bool equalLines(const vector<FeatureLine> &l1, const vector<FeatureLine> &l2)
+{
+  if (l1.size() != l2.size())
+    return false;
+  for (size_t i = 0; i < l1.size(); i++)
+  {
+    if (!(l1[i].startPoint == l2[i].startPoint) || !(l1[i].endPoint == l2[i].endPoint))
+      return false;
+  }
+  return true;
+}
+
+// the jobs of a batch give the morphs of single calls, warped one after the other on all threads (fewer jobs than
+// threads) or one job per thread
+void testBatchResults()
+{
+  TestInput in = makeInput(80, 72);
+  vector<FeatureLine> outlines;
+  vector<int> sizes;
+  vector<double> matrices;
+  tileJobs(in, 3, outlines, sizes, matrices);
+
+  vector<MorphResult> single;
+  for (int k = 0; k < 3; k++)
+    single.push_back(doMorphWithOutline(in.w, in.h, 0, 1, 2, 0.5, in.image, in.processed, in.skelleton, in.outline,
+                                        vector<double>(matrices.begin() + 6 * k, matrices.begin() + 6 * k + 6), WARP_GRID, 0.1f));
+  int threads[] = {1, 2, 4};
+  for (int i = 0; i < 3; i++)
+  {
+    setMorphThreads(threads[i]);
+    vector<MorphResult> results = doMorphBatch(in.w, in.h, 0, 1, 2, 0.5, in.image, in.processed, in.skelleton, outlines, sizes, matrices,
+                                               WARP_GRID, 0.1f);
+    CHECK(results.size() == 3);
+    for (size_t k = 0; k < results.size() && k < single.size(); k++)
+    {
+      CHECK(results[k].image == single[k].image);
+      CHECK(results[k].bbox == single[k].bbox);
+      CHECK(equalLines(results[k].outline, single[k].outline));
+    }
+  }
+  setMorphThreads(0);
+}
+
+// copies the processed image of in into the buffer slot
+void writeProcessedBuffer(const TestInput &in)
+{
+  memcpy(imageBuffer(IMAGE_PROCESSED_BUFFER, in.processed.size()), in.processed.data(), in.processed.size());
+}
+
+/* the buffer calls reuse the silhouette and the distance field until the processed image buffer is written again,
+   the vector calls build them for the call */
+void testProcessedImageCache()
+{
+  TestInput a = makeInput(64, 64, 0.35);
+  TestInput b = makeInput(64, 64, 0.25);
+  setMorphProjection(PROJECT_NEAREST);
+  vector<FeatureLine> outlineA = getMorphOutline(a.w, a.h, 1, a.processed, a.skelleton, a.outline, a.M);
+  vector<FeatureLine> outlineB = getMorphOutline(b.w, b.h, 1, b.processed, b.skelleton, b.outline, b.M);
+  CHECK(!equalLines(outlineA, outlineB));
+  CHECK(equalLines(outlineA, getMorphOutline(a.w, a.h, 1, a.processed, a.skelleton, a.outline, a.M)));
+
+  writeProcessedBuffer(a);
+  CHECK(equalLines(outlineA, getMorphOutlineBuffer(a.w, a.h, 1, a.skelleton, a.outline, a.M)));
+  std::shared_ptr<ProcessedImage> cached = lastProcessedImage;
+  CHECK(equalLines(outlineA, getMorphOutlineBuffer(a.w, a.h, 1, a.skelleton, a.outline, a.M)));
+  CHECK(lastProcessedImage == cached);
+  // a vector call in between does not replace it
+  CHECK(equalLines(outlineB, getMorphOutline(b.w, b.h, 1, b.processed, b.skelleton, b.outline, b.M)));
+  CHECK(lastProcessedImage == cached);
+
+  writeProcessedBuffer(b);
+  CHECK(equalLines(outlineB, getMorphOutlineBuffer(b.w, b.h, 1, b.skelleton, b.outline, b.M)));
+  CHECK(lastProcessedImage != cached);
+  setMorphProjection(PROJECT_SEARCH);
+}
+
+// copies the images of in into both buffer slots
+void writeBuffers(const TestInput &in)
+{
+  memcpy(imageBuffer(IMAGE_BUFFER, in.image.size()), in.image.data(), in.image.size());
+  writeProcessedBuffer(in);
+}
+
+// the buffer api gives the results of the vector calls: the outline and the batch on the images in the buffers
+void testBufferMorph()
+{
+  TestInput in = makeInput(80, 72);
+  writeBuffers(in);
+  CHECK(equalLines(getMorphOutlineBuffer(in.w, in.h, 0.5, in.skelleton, in.outline, in.M),
+                   getMorphOutline(in.w, in.h, 0.5, in.processed, in.skelleton, in.outline, in.M)));
+
+  vector<FeatureLine> outlines;
+  vector<int> sizes;
+  vector<double> matrices;
+  tileJobs(in, 3, outlines, sizes, matrices);
+  vector<MorphResult> batch = doMorphBatchBuffer(in.w, in.h, 0, 1, 2, 0.5, in.skelleton, outlines, sizes, matrices, WARP_GRID, 0.1f);
+  vector<MorphResult> expected = doMorphBatch(in.w, in.h, 0, 1, 2, 0.5, in.image, in.processed, in.skelleton, outlines, sizes, matrices,
+                                              WARP_GRID, 0.1f);
+  CHECK(batch.size() == 3);
+  for (size_t k = 0; k < batch.size() && k < expected.size(); k++)
+  {
+    CHECK(batch[k].image == expected[k].image);
+    CHECK(batch[k].bbox == expected[k].bbox);
+    CHECK(equalLines(batch[k].outline, expected[k].outline));
+  }
+
+  // buffers smaller than the image and unknown slots are rejected
+  CHECK(throwsRuntimeError([&]()
+                           { imageBufferData(IMAGE_BUFFER, in.w + 1, in.h); }));
+  CHECK(throwsRuntimeError([&]()
+                           { imageBuffer(2, 16); }));
+}
+
+// doMorphBuffer (morphBuffer into morphOutput) gives the image, outline and bbox of doMorphWithOutline in one pass
+void testLastMorphOutput()
+{
+  TestInput in = makeInput(80, 72);
+  MorphResult expected = doMorphWithOutline(in.w, in.h, 0, 1, 2, 0.5, in.image, in.processed, in.skelleton, in.outline, in.M, WARP_GRID, 0.1f);
+  writeBuffers(in);
+  vector<FeatureLine> outline = in.outline;
+  morphBuffer(in.w, in.h, 0, 1, 2, 0.5, imageBufferData(IMAGE_BUFFER, in.w, in.h), imageBufferData(IMAGE_PROCESSED_BUFFER, in.w, in.h),
+              imageBufferGenerations[IMAGE_PROCESSED_BUFFER], in.skelleton, outline, in.M, WARP_GRID, 0.1f, morphOutput);
+  CHECK(morphOutput.image == expected.image);
+  CHECK(equalLines(getLastMorphOutline(), expected.outline));
+  CHECK(getLastMorphBBox() == expected.bbox);
+}
+
+// fills the buffers of the session with the images of in
+void setSessionImages(MorphSession &session, const TestInput &in)
+{
+  vector<unsigned char> &image = session.imageBuffer(IMAGE_BUFFER, in.image.size());
+  memcpy(image.data(), in.image.data(), in.image.size());
+  vector<unsigned char> &processed = session.imageBuffer(IMAGE_PROCESSED_BUFFER, in.processed.size());
+  memcpy(processed.data(), in.processed.data(), in.processed.size());
+  session.setImages(in.w, in.h);
+}
+
+// a session gives the results of doMorph after every change, also when only some stages are re-run
+void testMorphSession()
+{
+  TestInput in = makeInput(80, 72);
+  MorphSession session;
+  CHECK(throwsRuntimeError([&]()
+                           { session.morphImage(); }));
+  setSessionImages(session, in);
+  session.setOutline(in.skelleton, in.outline, in.M);
+  session.setT(0.5);
+  session.setWarpParameters(0, 1, 2, WARP_GRID, 0.1f);
+  MorphResult expected = doMorphWithOutline(in.w, in.h, 0, 1, 2, 0.5, in.image, in.processed, in.skelleton, in.outline, in.M, WARP_GRID, 0.1f);
+  CHECK(session.morphImage() == expected.image);
+  CHECK(session.getBBox() == expected.bbox);
+  CHECK(equalLines(session.getOutline(), expected.outline));
+
+  // t only re-interpolates the lines
+  session.setT(0.25);
+  CHECK(session.morphImage() == doMorph(in.w, in.h, 0, 1, 2, 0.25, in.image, in.processed, in.skelleton, in.outline, in.M, WARP_GRID, 0.1f));
+  CHECK(equalLines(session.getOutline(), getMorphOutline(in.w, in.h, 0.25, in.processed, in.skelleton, in.outline, in.M)));
+
+  session.setWarpParameters(0.5, 1, 2, WARP_EXACT, 0);
+  CHECK(session.morphImage() == doMorph(in.w, in.h, 0.5, 1, 2, 0.25, in.image, in.processed, in.skelleton, in.outline, in.M));
+
+  double shifted[] = {1, 0, 0, 1, 3, -2};
+  vector<double> M(shifted, shifted + 6);
+  session.setOutline(in.skelleton, in.outline, M);
+  CHECK(session.morphImage() == doMorph(in.w, in.h, 0.5, 1, 2, 0.25, in.image, in.processed, in.skelleton, in.outline, M));
+
+  TestInput smaller = makeInput(80, 72, 0.25);
+  setSessionImages(session, smaller);
+  CHECK(session.morphImage() == doMorph(in.w, in.h, 0.5, 1, 2, 0.25, smaller.image, smaller.processed, in.skelleton, in.outline, M));
+  CHECK(throwsRuntimeError([&]()
+                           { session.setWarpParameters(0, 1, 2, 7, 0); }));
+}
+
+/* sessions share no results, one per thread gives the same images as serial calls. The buffer api keeps its results
+   in globals and has one caller at a time */
+void testConcurrentSessions()
+{
+  TestInput inputs[] = {makeInput(80, 72), makeInput(64, 64, 0.25)};
+  vector<unsigned char> expected[2];
+  for (int k = 0; k < 2; k++)
+    expected[k] = doMorph(inputs[k].w, inputs[k].h, 0, 1, 2, 0.5, inputs[k].image, inputs[k].processed, inputs[k].skelleton, inputs[k].outline,
+                          inputs[k].M, WARP_GRID, 0.1f);
+  setMorphThreads(2);
+  bool same[2] = {true, true};
+  vector<std::thread> threads;
+  for (int k = 0; k < 2; k++)
+    threads.push_back(std::thread([&, k]()
+                                  {
+                                    MorphSession session;
+                                    setSessionImages(session, inputs[k]);
+                                    session.setOutline(inputs[k].skelleton, inputs[k].outline, inputs[k].M);
+                                    session.setWarpParameters(0, 1, 2, WARP_GRID, 0.1f);
+                                    for (int run = 0; run < 4; run++)
+                                    {
+                                      session.setT(run % 2 ? 0.25f : 0.5f);
+                                      if (run % 2 == 0 && session.morphImage() != expected[k])
+                                        same[k] = false;
+                                    } }));
+  for (size_t k = 0; k < threads.size(); k++)
+    threads[k].join();
+  CHECK(same[0] && same[1]);
+  setMorphThreads(0);
+}
+
+// the warp on the persistent worker pool gives the same image as the serial loop, run after run
+void testThreadedMorph()
+{
+  TestInput in = makeInput(96, 80);
+  setMorphThreads(1);
+  vector<unsigned char> serial = doMorph(in.w, in.h, 0, 1, 2, 0.5, in.image, in.processed, in.skelleton, in.outline, in.M, WARP_GRID, 0.1f);
+  setMorphThreads(4);
+  for (int run = 0; run < 3; run++)
+    CHECK(doMorph(in.w, in.h, 0, 1, 2, 0.5, in.image, in.processed, in.skelleton, in.outline, in.M, WARP_GRID, 0.1f) == serial);
+  setMorphThreads(0);
+}
+
+// weightCutoff outside of [0, 1) is rejected instead of skipping every line of a cell
+void testWeightCutoff()
+{
+  TestInput in = makeInput(64, 64);
+  float invalid[] = {-0.1f, 1, 5, NAN};
+  for (int i = 0; i < 4; i++)
+  {
+    CHECK(throwsRuntimeError([&]()
+                             { doMorph(in.w, in.h, 0, 1, 2, 0.5, in.image, in.processed, in.skelleton, in.outline, in.M, WARP_GRID, invalid[i]); }));
+    CHECK(throwsRuntimeError([&]()
+                             { doMorphBatch(in.w, in.h, 0, 1, 2, 0.5, in.image, in.processed, in.skelleton, in.outline,
+                                            vector<int>(1, in.outline.size()), in.M, WARP_GRID, invalid[i]); }));
+  }
+  CHECK(!doMorph(in.w, in.h, 0, 1, 2, 0.5, in.image, in.processed, in.skelleton, in.outline, in.M, WARP_GRID, 0.99f).empty());
+}
+
+// a warpMode other than WARP_EXACT and WARP_GRID is rejected instead of running the exact warp
+void testWarpMode()
+{
+  TestInput in = makeInput(64, 64);
+  int invalid[] = {-1, 2, 100};
+  for (int i = 0; i < 3; i++)
+  {
+    CHECK(throwsRuntimeError([&]()
+                             { doMorph(in.w, in.h, 0, 1, 2, 0.5, in.image, in.processed, in.skelleton, in.outline, in.M, invalid[i], 0.1f); }));
+    CHECK(throwsRuntimeError([&]()
+                             { doMorphBatch(in.w, in.h, 0, 1, 2, 0.5, in.image, in.processed, in.skelleton, in.outline,
+                                            vector<int>(1, in.outline.size()), in.M, invalid[i], 0.1f); }));
+  }
+}
+
+// without a cutoff the grid skips no line, its image only differs from the exact warp by float rounding
+void testGridWithoutCutoff()
+{
+  TestInput in = makeInput(96, 80);
+  vector<unsigned char> exact = doMorph(in.w, in.h, 0, 1, 2, 0.5, in.image, in.processed, in.skelleton, in.outline, in.M, WARP_EXACT, 0);
+  vector<unsigned char> grid = doMorph(in.w, in.h, 0, 1, 2, 0.5, in.image, in.processed, in.skelleton, in.outline, in.M, WARP_GRID, 0);
+  CHECK(exact.size() == grid.size());
+  int maxDiff = 0;
+  for (size_t i = 0; i < exact.size() && i < grid.size(); i++)
+    maxDiff = Max(maxDiff, abs((int)exact[i] - (int)grid[i]));
+  CHECK(maxDiff <= 1);
+}
+
+// the 4 lane kernel samples the same image as the scalar path, up to one intensity step from float rounding
+void testSimd()
+{
+  TestInput in = makeInput(101, 80);
+  int modes[] = {WARP_EXACT, WARP_GRID};
+  for (int m = 0; m < 2; m++)
+  {
+    setMorphSimd(false);
+    vector<unsigned char> scalar = doMorph(in.w, in.h, 0, 1, 2, 0.5, in.image, in.processed, in.skelleton, in.outline, in.M, modes[m], 0.1f);
+    setMorphSimd(true);
+    vector<unsigned char> simd = doMorph(in.w, in.h, 0, 1, 2, 0.5, in.image, in.processed, in.skelleton, in.outline, in.M, modes[m], 0.1f);
+    CHECK(scalar.size() == simd.size());
+    int maxDiff = 0;
+    for (size_t i = 0; i < scalar.size() && i < simd.size(); i++)
+      maxDiff = Max(maxDiff, abs((int)scalar[i] - (int)simd[i]));
+    CHECK(maxDiff <= 1);
+  }
+}
+
+// an outline of several loops or with an open chain is reported instead of morphing a part of it
+void testBrokenOutlines()
+{
+  TestInput in = makeInput(64, 64);
+  vector<FeatureLine> twoLoops = in.outline;
+  for (size_t i = 0; i < in.outline.size(); i++)
+    twoLoops.push_back(FeatureLine(Point(in.outline[i].startPoint + Vector2d(100, 0)), Point(in.outline[i].endPoint + Vector2d(100, 0))));
+  vector<FeatureLine> open(in.outline.begin() + 1, in.outline.end());
+  vector<FeatureLine> stray = in.outline;
+  stray.push_back(FeatureLine(Point(Vector2d(1, 1)), Point(Vector2d(2, 1))));
+
+  vector<FeatureLine> broken[] = {twoLoops, open, stray};
+  for (int i = 0; i < 3; i++)
+  {
+    CHECK(throwsRuntimeError([&]()
+                             { getMorphOutline(in.w, in.h, 0.5, in.processed, in.skelleton, broken[i], in.M); }));
+  }
+  CHECK(!getMorphOutline(in.w, in.h, 0.5, in.processed, in.skelleton, in.outline, in.M).empty());
+}
+
+// a pseudo random number in [0, n), the same on every platform
+unsigned int nextRandom(unsigned int &state, unsigned int n)
+{
+  state = state * 1103515245u + 12345u;
+  return (state >> 8) % n;
+}
+
+// the nearest end point like projectOutlineLines searched it before the tree: all lines in order, start before end
+// point, float distances, the first one on ties
+int nearestEndpointBruteForce(const vector<FeatureLine> &lines, const Vector2d &p)
+{
+  float best = std::numeric_limits<float>::max();
+  int bestIdx = -1;
+  for (size_t j = 0; j < lines.size(); j++)
+  {
+    for (int e = 0; e < 2; e++)
+    {
+      Vector2d q = skelletonEndpoint(lines, 2 * j + e);
+      float d = (p.x - q.x) * (p.x - q.x) + (p.y - q.y) * (p.y - q.y);
+      if (d < best)
+      {
+        best = d;
+        bestIdx = 2 * j + e;
+      }
+    }
+  }
+  return bestIdx;
+}
+
+// the KD-tree finds the same end point as the brute force search, also for shared end points and equal distances
+void testEndpointTree()
+{
+  unsigned int state = 1;
+  int counts[] = {1, 2, 7, 40, 300};
+  for (int c = 0; c < 5; c++)
+  {
+    // coarse integer coordinates so many end points coincide and many queries have ties
+    vector<FeatureLine> lines;
+    for (int j = 0; j < counts[c]; j++)
+      lines.push_back(FeatureLine(Point(Vector2d(nextRandom(state, 20), nextRandom(state, 20))),
+                                  Point(Vector2d(nextRandom(state, 20), nextRandom(state, 20)))));
+    EndpointTree tree(lines);
+    for (int q = 0; q < 2000; q++)
+    {
+      Vector2d p = q % 2 ? Vector2d(nextRandom(state, 24) - 2, nextRandom(state, 24) - 2)
+                         : Vector2d(nextRandom(state, 2400) * 0.01 - 2, nextRandom(state, 2400) * 0.01 - 2);
+      CHECK(tree.nearest(p) == nearestEndpointBruteForce(lines, p));
+    }
+  }
+  CHECK(EndpointTree(vector<FeatureLine>()).nearest(Vector2d(0, 0)) == -1);
+}
+
+// a processed image for the reference checks
+struct Fixture
+{
+  string name;
+  int w, h;
+  vector<unsigned char> processed;
+};
+
+void setPixel(Fixture &f, int x, int y, unsigned char v, unsigned char alpha = 255)
+{
+  size_t i = ((size_t)y * f.w + x) * 4;
+  f.processed[i] = f.processed[i + 1] = f.processed[i + 2] = v;
+  f.processed[i + 3] = alpha;
+}
+
+#ifdef HAVE_PNG
+// white where the image is light, black elsewhere
+bool loadFixture(const string &path, Fixture &f)
+{
+  png_image image;
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+  if (!png_image_begin_read_from_file(&image, path.c_str()))
+    return false;
+  image.format = PNG_FORMAT_RGBA;
+  vector<unsigned char> rgba(PNG_IMAGE_SIZE(image));
+  if (!png_image_finish_read(&image, NULL, rgba.data(), 0, NULL))
+  {
+    png_image_free(&image);
+    return false;
+  }
+  f.name = std::filesystem::path(path).filename().string();
+  f.w = image.width;
+  f.h = image.height;
+  f.processed.resize(rgba.size());
+  for (int y = 0; y < f.h; y++)
+    for (int x = 0; x < f.w; x++)
+    {
+      const unsigned char *p = &rgba[((size_t)y * f.w + x) * 4];
+      setPixel(f, x, y, p[3] >= 128 && p[0] * 3 + p[1] * 6 + p[2] >= 1280 ? 255 : 0);
+    }
+  return true;
+}
+#endif
+
+/* the disc of makeInput, the disc with pixel noise (spurs, holes, islands and half transparent black pixels), thin lines,
+   an empty image and, with libpng, the thresholded images of src/lib/images */
+vector<Fixture> fixtures()
+{
+  vector<Fixture> result;
+  TestInput in = makeInput(64, 48);
+  Fixture disc = {"disc", in.w, in.h, in.processed};
+  result.push_back(disc);
+
+  unsigned int state = 7;
+  Fixture noisy = disc;
+  noisy.name = "noisy disc";
+  for (int k = 0; k < 300; k++)
+    setPixel(noisy, nextRandom(state, noisy.w), nextRandom(state, noisy.h), k % 2 ? 255 : 0, k % 5 ? 255 : 128);
+  result.push_back(noisy);
+
+  Fixture lines = {"lines", 57, 41, vector<unsigned char>((size_t)57 * 41 * 4, 0)};
+  for (int k = 0; k < 12; k++)
+  {
+    int x = nextRandom(state, lines.w), y = nextRandom(state, lines.h), len = nextRandom(state, 40), dir = nextRandom(state, 3);
+    for (int j = 0; j < len; j++)
+    {
+      int xx = x + (dir != 1 ? j : 0), yy = y + (dir != 0 ? j : 0);
+      if (xx < lines.w && yy < lines.h)
+        setPixel(lines, xx, yy, 255);
+    }
+  }
+  result.push_back(lines);
+
+  Fixture empty = {"empty", 16, 9, vector<unsigned char>((size_t)16 * 9 * 4, 0)};
+  for (int y = 0; y < empty.h; y++)
+    for (int x = 0; x < empty.w; x++)
+      setPixel(empty, x, y, 0);
+  result.push_back(empty);
+
+#ifdef HAVE_PNG
+  vector<string> files;
+  for (const auto &entry : std::filesystem::directory_iterator(ESCHER_IMAGE_DIR))
+    if (entry.path().extension() == ".png")
+      files.push_back(entry.path().string());
+  std::sort(files.begin(), files.end());
+  for (size_t i = 0; i < files.size(); i++)
+  {
+    Fixture f;
+    if (loadFixture(files[i], f))
+      result.push_back(f);
+  }
+#endif
+  return result;
+}
+
+// black like the javascript tested it: outside of the image or opaque 0, 0, 0
+bool isBlackReference(const Fixture &f, int x, int y)
+{
+  if (x < 0 || x >= f.w || y < 0 || y >= f.h)
+    return true;
+  const unsigned char *p = &f.processed[((size_t)y * f.w + x) * 4];
+  return p[0] == 0 && p[1] == 0 && p[2] == 0 && p[3] == 255;
+}
+
+// the bit mask tells black pixels like the rgba test, inside of the image, on the guard border and beyond
+void testSilhouetteMask(const vector<Fixture> &images)
+{
+  for (size_t i = 0; i < images.size(); i++)
+  {
+    const Fixture &f = images[i];
+    SilhouetteMask mask(f.w, f.h, f.processed.data());
+    int wrong = 0;
+    for (int y = -2; y < f.h + 2; y++)
+      for (int x = -2; x < f.w + 2; x++)
+      {
+        bool black = isBlackReference(f, x, y);
+        if (mask.isBlack(Vector2dInt(x, y)) != black)
+          wrong++;
+        if (x >= -1 && x <= f.w && y >= -1 && y <= f.h && mask.isBlackGuarded(Vector2dInt(x, y)) != black)
+          wrong++;
+      }
+    if (wrong)
+      printf("%s: %d wrong mask pixels\n", f.name.c_str(), wrong);
+    CHECK(wrong == 0);
+  }
+}
+
+/* the field gives a white pixel at the smallest distance, checked against all white pixels. Every pixel of the small
+   images is checked, a sample of the large ones */
+void testDistanceField(const vector<Fixture> &images)
+{
+  unsigned int state = 3;
+  for (size_t i = 0; i < images.size(); i++)
+  {
+    const Fixture &f = images[i];
+    SilhouetteMask mask(f.w, f.h, f.processed.data());
+    DistanceField field(mask);
+    vector<Vector2dInt> white;
+    for (int y = 0; y < f.h; y++)
+      for (int x = 0; x < f.w; x++)
+        if (!isBlackReference(f, x, y))
+          white.push_back(Vector2dInt(x, y));
+
+    bool all = (long long)f.w * f.h <= 4096;
+    int queries = all ? f.w * f.h : 200;
+    int wrong = 0;
+    for (int q = 0; q < queries; q++)
+    {
+      Vector2dInt c = all ? Vector2dInt(q % f.w, q / f.w) : Vector2dInt(nextRandom(state, f.w), nextRandom(state, f.h));
+      long long best = -1;
+      for (size_t k = 0; k < white.size(); k++)
+      {
+        long long d = (long long)(white[k].x - c.x) * (white[k].x - c.x) + (long long)(white[k].y - c.y) * (white[k].y - c.y);
+        if (best < 0 || d < best)
+          best = d;
+      }
+      Vector2dInt n;
+      bool found = field.nearest(c, n);
+      if (found != (best >= 0) ||
+          (found && (isBlackReference(f, n.x, n.y) ||
+                     (long long)(n.x - c.x) * (n.x - c.x) + (long long)(n.y - c.y) * (n.y - c.y) != best)))
+        wrong++;
+    }
+    if (wrong)
+      printf("%s: %d wrong nearest pixels\n", f.name.c_str(), wrong);
+    CHECK(wrong == 0);
+    Vector2dInt n;
+    CHECK(!field.nearest(Vector2dInt(-1, 0), n) && !field.nearest(Vector2dInt(0, f.h), n));
+  }
+}
+
+// traceBoundary like it was before the contours were indexed: the step walk of walkBoundary for every line
+void traceBoundaryReference(vector<FeatureLine> &outlineLinesSorted, vector<FeatureLine> &outlineLinesMorphed,
+                            vector<FeatureLine> &result_inner, vector<FeatureLine> &result_outer,
+                            const SilhouetteMask &silhouette)
+{
+  vector<FeatureLine>::iterator it_o = outlineLinesSorted.begin();
+  for (vector<FeatureLine>::iterator it = outlineLinesMorphed.begin(); it < outlineLinesMorphed.end(); ++it, ++it_o)
+  {
+    if (!isBoundaryPoint(it->startPoint, silhouette) || !isBoundaryPoint(it->endPoint, silhouette))
+    {
+      result_inner.push_back(*it);
+      result_outer.push_back(*it_o);
+      continue;
+    }
+    FeatureLine prev_line = it == outlineLinesMorphed.begin() ? outlineLinesMorphed.back() : *(it - 1);
+    walkBoundary(it, it_o, prev_line, result_inner, result_outer, silhouette);
+  }
+}
+
+/* the boundary slices of the indexed contours are the ones of the step walk, also for walks the wrong way round and
+   loops that never reach the end point. Square outlines around the center of every fixture, scaled, rotated and
+   in both directions */
+void testTraceBoundary(const vector<Fixture> &images)
+{
+  for (size_t i = 0; i < images.size(); i++)
+  {
+    const Fixture &f = images[i];
+    SilhouetteMask mask(f.w, f.h, f.processed.data());
+    double cx = f.w / 2, cy = f.h / 2;
+    vector<FeatureLine> skelleton;
+    double size = 0.15 * Min(f.w, f.h);
+    skelleton.push_back(FeatureLine(Point(Vector2d(cx - size, cy + 0.3)), Point(Vector2d(cx + size, cy))));
+    skelleton.push_back(FeatureLine(Point(Vector2d(cx, cy - size)), Point(Vector2d(cx + 0.2, cy + size))));
+
+    int step = Max(4, Min(f.w, f.h) / 40);
+    vector<Vector2d> pts;
+    int lo_x = 0.1 * f.w, hi_x = 0.9 * f.w, lo_y = 0.1 * f.h, hi_y = 0.9 * f.h;
+    for (int x = lo_x; x < hi_x; x += step)
+      pts.push_back(Vector2d(x, lo_y));
+    for (int y = lo_y; y < hi_y; y += step)
+      pts.push_back(Vector2d(hi_x, y));
+    for (int x = hi_x; x > lo_x; x -= step)
+      pts.push_back(Vector2d(x, hi_y));
+    for (int y = hi_y; y > lo_y; y -= step)
+      pts.push_back(Vector2d(lo_x, y));
+
+    // the step walk of the reference is slow on the large images, they get two of the outlines
+    int variants = (long long)f.w * f.h <= 4096 ? 4 : 2;
+    int wrong = 0;
+    for (int v = 0; v < variants; v++)
+    {
+      vector<FeatureLine> outline;
+      for (size_t k = 0; k < pts.size(); k++)
+      {
+        FeatureLine l(Point(pts[k]), Point(pts[(k + 1) % pts.size()]));
+        if (v % 2)
+          std::swap(l.startPoint, l.endPoint);
+        outline.push_back(l);
+      }
+      double scale = 1 - 0.15 * v, angle = 0.2 * v;
+      double c = cos(angle) * scale, s = sin(angle) * scale;
+      double M[] = {c, s, -s, c, cx - c * cx + s * cy, cy - s * cx - c * cy};
+
+      vector<FeatureLine> sorted = sortOutlineLines(outline);
+      transformAll(sorted, vector<double>(M, M + 6));
+      vector<FeatureLine> morphed = projectOutlineLines(sorted, skelleton, mask, NULL);
+      removeZeroLengthLines(sorted, morphed);
+
+      vector<FeatureLine> sorted2 = sorted, morphed2 = morphed;
+      vector<FeatureLine> inner, outer, innerRef, outerRef;
+      long long loops = getBadLoops();
+      traceBoundary(sorted, morphed, inner, outer, mask);
+      loops = getBadLoops() - loops;
+      long long loopsRef = getBadLoops();
+      traceBoundaryReference(sorted2, morphed2, innerRef, outerRef, mask);
+      loopsRef = getBadLoops() - loopsRef;
+      if (!equalLines(inner, innerRef) || !equalLines(outer, outerRef) || loops != loopsRef)
+        wrong++;
+    }
+    if (wrong)
+      printf("%s: %d outlines traced differently\n", f.name.c_str(), wrong);
+    CHECK(wrong == 0);
+  }
+}
+
+int main()
+{
+  testTracingErrors();
+  testBatchErrors();
+  testBatchResults();
+  testProcessedImageCache();
+  testBufferMorph();
+  testLastMorphOutput();
+  testMorphSession();
+  testConcurrentSessions();
+  testThreadedMorph();
+  testWeightCutoff();
+  testWarpMode();
+  testGridWithoutCutoff();
+  testSimd();
+  testEndpointTree();
+
+  vector<Fixture> images = fixtures();
+  testSilhouetteMask(images);
+  testDistanceField(images);
+  testTraceBoundary(images);
+  testBrokenOutlines();
+
+  if (failures)
+    printf("%d checks failed\n", failures);
+  else
+    printf("all checks passed\n");
+  return failures ? 1 : 0;
+}
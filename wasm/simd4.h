@@ -0,0 +1,73 @@
+#ifndef _H_SIMD4
+#define _H_SIMD4
+
+/*
+  Minimal 4 lane float vector used by the morph kernel.
+  Maps to wasm simd128 (emcc -msimd128) or SSE2 (native x86), MORPH_SIMD is 0
+  if neither is available and the morph falls back to the scalar path.
+  Both mappings give the same results: f4_min(a, b) is a < b ? a : b and f4_max(a, b) is a > b ? a : b, a NaN
+  in a lane gives b like SSE minps / maxps. f4_floor is only valid for |a| < 2^31 (the SSE2 path converts to int32).
+*/
+
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define MORPH_SIMD 1
+typedef v128_t f4;
+
+inline f4 f4_set1(float v) { return wasm_f32x4_splat(v); }
+inline f4 f4_set(float a, float b, float c, float d) { return wasm_f32x4_make(a, b, c, d); }
+inline f4 f4_add(f4 a, f4 b) { return wasm_f32x4_add(a, b); }
+inline f4 f4_sub(f4 a, f4 b) { return wasm_f32x4_sub(a, b); }
+inline f4 f4_mul(f4 a, f4 b) { return wasm_f32x4_mul(a, b); }
+inline f4 f4_div(f4 a, f4 b) { return wasm_f32x4_div(a, b); }
+inline f4 f4_sqrt(f4 a) { return wasm_f32x4_sqrt(a); }
+inline f4 f4_abs(f4 a) { return wasm_f32x4_abs(a); }
+// pmin(x, y) is y < x ? y : x, the swapped operands give the minps semantics
+inline f4 f4_min(f4 a, f4 b) { return wasm_f32x4_pmin(b, a); }
+inline f4 f4_max(f4 a, f4 b) { return wasm_f32x4_pmax(b, a); }
+inline f4 f4_floor(f4 a) { return wasm_f32x4_floor(a); }
+inline f4 f4_lt(f4 a, f4 b) { return wasm_f32x4_lt(a, b); }
+inline f4 f4_gt(f4 a, f4 b) { return wasm_f32x4_gt(a, b); }
+inline f4 f4_or(f4 a, f4 b) { return wasm_v128_or(a, b); }
+inline f4 f4_isnan(f4 a) { return wasm_f32x4_ne(a, a); }
+// mask ? a : b
+inline f4 f4_select(f4 mask, f4 a, f4 b) { return wasm_v128_bitselect(a, b, mask); }
+inline int f4_movemask(f4 mask) { return wasm_i32x4_bitmask(mask); }
+inline void f4_store(float *dst, f4 a) { wasm_v128_store(dst, a); }
+
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MORPH_SIMD 1
+typedef __m128 f4;
+
+inline f4 f4_set1(float v) { return _mm_set1_ps(v); }
+inline f4 f4_set(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+inline f4 f4_add(f4 a, f4 b) { return _mm_add_ps(a, b); }
+inline f4 f4_sub(f4 a, f4 b) { return _mm_sub_ps(a, b); }
+inline f4 f4_mul(f4 a, f4 b) { return _mm_mul_ps(a, b); }
+inline f4 f4_div(f4 a, f4 b) { return _mm_div_ps(a, b); }
+inline f4 f4_sqrt(f4 a) { return _mm_sqrt_ps(a); }
+inline f4 f4_abs(f4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+inline f4 f4_min(f4 a, f4 b) { return _mm_min_ps(a, b); }
+inline f4 f4_max(f4 a, f4 b) { return _mm_max_ps(a, b); }
+inline f4 f4_lt(f4 a, f4 b) { return _mm_cmplt_ps(a, b); }
+inline f4 f4_gt(f4 a, f4 b) { return _mm_cmpgt_ps(a, b); }
+inline f4 f4_or(f4 a, f4 b) { return _mm_or_ps(a, b); }
+inline f4 f4_isnan(f4 a) { return _mm_cmpunord_ps(a, a); }
+// mask ? a : b
+inline f4 f4_select(f4 mask, f4 a, f4 b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+// SSE2 has no round instruction, truncation corrected for negative values. cvttps gives INT_MIN for |a| >= 2^31 and NaN,
+// the callers only floor clamped pixel coordinates
+inline f4 f4_floor(f4 a)
+{
+  f4 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+  return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), _mm_set1_ps(1.0f)));
+}
+inline int f4_movemask(f4 mask) { return _mm_movemask_ps(mask); }
+inline void f4_store(float *dst, f4 a) { _mm_storeu_ps(dst, a); }
+
+#else
+#define MORPH_SIMD 0
+#endif
+
+#endif
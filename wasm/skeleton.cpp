@@ -0,0 +1,744 @@
+// Skeleton of a tile silhouette as site segments: Zhang-Suen thinning and vectorization of the thinned image.
+// Port of Vectorization.updateSkelleton (src/lib/vectorization.ts) and TraceSkeleton.thinningZS
+// (src/lib/thinning/thinning.js), gives the same segments for the same image.
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/bind.h>
+using namespace emscripten;
+#else
+#define EMSCRIPTEN_KEEPALIVE
+#endif
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <mutex>
+
+#include "skeleton.h"
+
+using std::vector;
+
+//--------------------------------------------------------------------------
+//------------------------bitmap--------------------------------------------
+//--------------------------------------------------------------------------
+struct Pixel
+{
+  int x, y;
+};
+
+static bool operator==(const Pixel &a, const Pixel &b) { return a.x == b.x && a.y == b.y; }
+
+/* one byte per pixel. at() uses the linear index y * w + x like the javascript arrays did: x outside of the image
+   wraps into the neighbour row, indices outside of the image read 0 */
+class Bitmap
+{
+public:
+  Bitmap(int w, int h) : w(w), h(h), data((size_t)w * h, 0) {}
+
+  int width() const { return w; }
+  int height() const { return h; }
+  size_t size() const { return data.size(); }
+
+  unsigned char at(int x, int y) const
+  {
+    long long i = (long long)y * w + x;
+    return i >= 0 && i < (long long)data.size() ? data[i] : 0;
+  }
+
+  // pixel inside of the image
+  unsigned char &operator()(int x, int y) { return data[(size_t)y * w + x]; }
+  unsigned char &operator[](size_t i) { return data[i]; }
+  unsigned char operator[](size_t i) const { return data[i]; }
+
+  // 8 neighbours as bits A (x-1, y-1) = 1, B (x, y-1) = 2, C (x+1, y-1) = 4, D (x-1, y) = 8, E (x+1, y) = 16,
+  // F (x-1, y+1) = 32, G (x, y+1) = 64, H (x+1, y+1) = 128
+  int neighbourBits(int x, int y) const
+  {
+    return (at(x - 1, y - 1) ? 1 : 0) | (at(x, y - 1) ? 2 : 0) | (at(x + 1, y - 1) ? 4 : 0) |
+           (at(x - 1, y) ? 8 : 0) | (at(x + 1, y) ? 16 : 0) |
+           (at(x - 1, y + 1) ? 32 : 0) | (at(x, y + 1) ? 64 : 0) | (at(x + 1, y + 1) ? 128 : 0);
+  }
+
+private:
+  int w, h;
+  vector<unsigned char> data;
+};
+
+//--------------------------------------------------------------------------
+//------------------------neighbour patterns--------------------------------
+//--------------------------------------------------------------------------
+// the corner, crossing and end conditions of vectorization.ts for all 256 neighbour patterns (Bitmap::neighbourBits)
+#define PATTERN_CROSSING       1 // exactly a crossing pattern (detectEndsAndCrossings)
+#define PATTERN_END            2 // exactly one neighbour
+#define PATTERN_KEEP           4 // contains a crossing pattern (erodeKeepCrossings)
+#define PATTERN_ERODE          8 // 4-neighbourhood corner (erodeKeepCrossings, if the pixel is set)
+
+static unsigned char neighbourPatterns[256];
+static std::once_flag neighbourPatternsReady;
+
+static void computeNeighbourPatterns()
+{
+  for (int bits = 0; bits < 256; bits++)
+  {
+    bool A = bits & 1, B = bits & 2, C = bits & 4, D = bits & 8, E = bits & 16, F = bits & 32, G = bits & 64, H = bits & 128;
+
+    bool C1 =
+        (D && E && G && !A && !B && !C && !F && !H) ||
+        (B && D && G && !A && !C && !E && !F && !H) ||
+        (B && D && E && !A && !C && !F && !G && !H) ||
+        (B && E && G && !A && !C && !D && !F && !H);
+    bool C2 =
+        (C && D && G && !A && !B && !E && !F && !H) ||
+        (B && D && H && !A && !C && !E && !F && !G) ||
+        (B && E && F && !A && !C && !D && !G && !H) ||
+        (A && E && G && !B && !C && !D && !F && !H);
+    bool C3 =
+        (A && C && G && !B && !D && !E && !F && !H) ||
+        (C && D && H && !A && !B && !E && !F && !G) ||
+        (B && F && H && !A && !C && !D && !E && !G) ||
+        (A && E && F && !B && !C && !D && !G && !H);
+    bool C4 =
+        (A && F && H && !B && !C && !D && !E && !G) ||
+        (A && C && F && !B && !D && !E && !G && !H) ||
+        (A && C && H && !B && !D && !E && !F && !G) ||
+        (C && F && H && !A && !B && !D && !E && !G);
+
+    bool K1 = (D && E && G) || (B && D && G) || (B && D && E) || (B && E && G);
+    bool K2 = (C && D && G) || (B && D && H) || (B && E && F) || (A && E && G);
+    bool K3 = (A && C && G) || (C && D && H) || (B && F && H) || (A && E && F);
+    bool K4 = (A && F && H) || (A && C && F) || (A && C && H) || (C && F && H);
+
+    bool erode = (E && G) || (E && B) || (D && B) || (D && G);
+
+    unsigned char pattern = 0;
+    if (C1 || C2 || C3 || C4)
+      pattern |= PATTERN_CROSSING;
+    if (bits && !(bits & (bits - 1)))
+      pattern |= PATTERN_END;
+    if (K1 || K2 || K3 || K4)
+      pattern |= PATTERN_KEEP;
+    if (erode)
+      pattern |= PATTERN_ERODE;
+    neighbourPatterns[bits] = pattern;
+  }
+}
+
+// the table is filled by the first caller, concurrent build_skeleton calls wait for it
+static void initNeighbourPatterns()
+{
+  std::call_once(neighbourPatternsReady, computeNeighbourPatterns);
+}
+
+//--------------------------------------------------------------------------
+//------------------------preprocessing-------------------------------------
+//--------------------------------------------------------------------------
+// black pixel of the RGBA image, indices outside of the image are not black (javascript reads undefined)
+static bool isBlack(const unsigned char *rgba, int w, int h, int x, int y)
+{
+  long long i = (long long)y * w + x;
+  if (i < 0 || i >= (long long)w * h)
+    return false;
+  const unsigned char *p = rgba + i * 4;
+  return p[0] == 0 && p[1] == 0 && p[2] == 0;
+}
+
+// writes outside of the image are ignored
+static void setColor(unsigned char *rgba, int w, int h, int x, int y, const unsigned char *color)
+{
+  long long i = (long long)y * w + x;
+  if (i >= 0 && i < (long long)w * h)
+    memcpy(rgba + i * 4, color, 4);
+}
+
+/* removes single pixels and fills the 8-neighbourhood of pixels where more than one passage meets, so the thinning
+   does not break them apart. In place and in the column order of Vectorization.fixSmallPassages */
+static void fixSmallPassages(unsigned char *rgba, int w, int h)
+{
+  static const int nx[8] = {-1, -1, -1, 0, 1, 1, 1, 0};
+  static const int ny[8] = {-1, 0, 1, 1, 1, 0, -1, -1};
+  static const unsigned char transparent[4] = {0, 0, 0, 0};
+
+  for (int x = 0; x < w; x++)
+  {
+    for (int y = 0; y < h; y++)
+    {
+      if (isBlack(rgba, w, h, x, y))
+        continue;
+      if (isBlack(rgba, w, h, x - 1, y) && isBlack(rgba, w, h, x + 1, y) &&
+          isBlack(rgba, w, h, x, y - 1) && isBlack(rgba, w, h, x, y + 1))
+        setColor(rgba, w, h, x, y, transparent);
+
+      bool active = isBlack(rgba, w, h, x + nx[0], y + ny[0]);
+      int switches = 0;
+      unsigned char lastColor[4] = {0, 0, 0, 0};
+      for (int i = 1; i < 8; i++)
+      {
+        bool black = isBlack(rgba, w, h, x + nx[i], y + ny[i]);
+        if (active != black)
+        {
+          switches++;
+          active = black;
+        }
+        if (!black)
+          memcpy(lastColor, rgba + ((size_t)y * w + x) * 4, 4);
+      }
+      if (switches > 3)
+      {
+        for (int i = 0; i < 8; i++)
+          setColor(rgba, w, h, x + nx[i], y + ny[i], lastColor);
+      }
+    }
+  }
+}
+
+//--------------------------------------------------------------------------
+//------------------------thinning------------------------------------------
+//--------------------------------------------------------------------------
+/* Zhang-Suen thinning in place. A pass only tests the set pixels next to a background pixel (pixels with all 8
+   neighbours set are never removed), the removed ones add their neighbours to the next pass. Ends like
+   TraceSkeleton.thinningZS: as soon as one of the two sub iterations removes nothing */
+class Thinning
+{
+public:
+  Thinning(Bitmap &im) : im(im), w(im.width()), h(im.height()), queued(im.size(), 0)
+  {
+    for (int y = 1; y < h - 1; y++)
+    {
+      for (int x = 1; x < w - 1; x++)
+      {
+        size_t i = (size_t)y * w + x;
+        if (im[i] && (im.neighbourBits(x, y) != 255))
+        {
+          queued[i] = 1;
+          border.push_back(i);
+        }
+      }
+    }
+  }
+
+  void run()
+  {
+    bool diff;
+    do
+    {
+      bool diff0 = iteration(0);
+      bool diff1 = iteration(1);
+      diff = diff0 && diff1;
+    } while (diff);
+  }
+
+private:
+  Bitmap &im;
+  int w, h;
+  vector<unsigned char> queued;
+  vector<size_t> border, removed;
+
+  // one sub iteration, all pixels are tested before any is removed
+  bool iteration(int iter)
+  {
+    removed.clear();
+    for (size_t k = 0; k < border.size(); k++)
+    {
+      size_t i = border[k];
+      int p2 = im[i - w], p3 = im[i - w + 1], p4 = im[i + 1], p5 = im[i + w + 1];
+      int p6 = im[i + w], p7 = im[i + w - 1], p8 = im[i - 1], p9 = im[i - w - 1];
+
+      int A = (p2 == 0 && p3 == 1) + (p3 == 0 && p4 == 1) +
+              (p4 == 0 && p5 == 1) + (p5 == 0 && p6 == 1) +
+              (p6 == 0 && p7 == 1) + (p7 == 0 && p8 == 1) +
+              (p8 == 0 && p9 == 1) + (p9 == 0 && p2 == 1);
+      int B = p2 + p3 + p4 + p5 + p6 + p7 + p8 + p9;
+      int m1 = iter == 0 ? (p2 * p4 * p6) : (p2 * p4 * p8);
+      int m2 = iter == 0 ? (p4 * p6 * p8) : (p2 * p6 * p8);
+
+      if (A == 1 && (B >= 2 && B <= 6) && m1 == 0 && m2 == 0)
+        removed.push_back(i);
+    }
+    for (size_t k = 0; k < removed.size(); k++)
+      im[removed[k]] = 0;
+
+    // survivors stay on the border, set neighbours of removed pixels join it
+    size_t n = 0;
+    for (size_t k = 0; k < border.size(); k++)
+    {
+      if (im[border[k]])
+        border[n++] = border[k];
+      else
+        queued[border[k]] = 0;
+    }
+    border.resize(n);
+    for (size_t k = 0; k < removed.size(); k++)
+    {
+      int x = removed[k] % w, y = removed[k] / w;
+      for (int dy = -1; dy <= 1; dy++)
+      {
+        for (int dx = -1; dx <= 1; dx++)
+        {
+          int nx = x + dx, ny = y + dy;
+          if (nx < 1 || nx >= w - 1 || ny < 1 || ny >= h - 1)
+            continue;
+          size_t j = (size_t)ny * w + nx;
+          if (im[j] && !queued[j])
+          {
+            queued[j] = 1;
+            border.push_back(j);
+          }
+        }
+      }
+    }
+    return !removed.empty();
+  }
+};
+
+// erodes the skeleton to 4-neighbourhood but keeps potential crossings, in place (Vectorization.erodeKeepCrossings)
+static void erodeKeepCrossings(Bitmap &im)
+{
+  int w = im.width();
+  for (size_t i = 0; i < im.size(); i++)
+  {
+    if (!im[i])
+      continue;
+    unsigned char pattern = neighbourPatterns[im.neighbourBits(i % w, i / w)];
+    if ((pattern & PATTERN_ERODE) && !(pattern & PATTERN_KEEP))
+      im[i] = 0;
+  }
+}
+
+// labels crossings and ends in place (Vectorization.detectEndsAndCrossings)
+static void detectEndsAndCrossings(Bitmap &im, vector<Pixel> &crossings, vector<Pixel> &ends)
+{
+  int w = im.width();
+  for (size_t i = 0; i < im.size(); i++)
+  {
+    Pixel p = {(int)(i % w), (int)(i / w)};
+    unsigned char pattern = neighbourPatterns[im.neighbourBits(p.x, p.y)];
+    if (pattern & PATTERN_CROSSING)
+    {
+      im[i] = SKELETON_CROSSING;
+      crossings.push_back(p);
+    }
+    else if (im[i] && (pattern & PATTERN_END))
+    {
+      im[i] = SKELETON_END;
+      ends.push_back(p);
+    }
+  }
+}
+
+//--------------------------------------------------------------------------
+//------------------------vectorization-------------------------------------
+//--------------------------------------------------------------------------
+// labels of the thinned image while it is vectorized
+#define VISITED          4
+#define VISITED_CROSSING 5
+
+/* tree of the skeleton, a node per end, crossing and subdivision point. The pixel lists are shared between nodes
+   like the javascript arrays were, a node refers to its list by index */
+struct SkeletonNode
+{
+  Pixel point;
+  int parent;
+  vector<int> children;
+  vector<int> loops;
+  int pixels;
+  int segment;
+};
+
+struct SkeletonTree
+{
+  vector<SkeletonNode> nodes;
+  vector<vector<Pixel>> pixels;
+
+  int addPixels()
+  {
+    pixels.push_back(vector<Pixel>());
+    return pixels.size() - 1;
+  }
+
+  // new node, appended to the children of parent (-1 for none)
+  int addNode(Pixel point, int parent, int pixelList)
+  {
+    SkeletonNode node;
+    node.point = point;
+    node.parent = parent;
+    node.pixels = pixelList;
+    node.segment = -1;
+    nodes.push_back(node);
+    int idx = nodes.size() - 1;
+    if (parent >= 0)
+      nodes[parent].children.push_back(idx);
+    return idx;
+  }
+};
+
+// set 8-neighbours, ends and crossings first (Vectorization.get1Neighbours)
+static int neighbours(const Bitmap &im, Pixel p, Pixel *result)
+{
+  static const int nx[8] = {-1, -1, -1, 0, 0, 1, 1, 1};
+  static const int ny[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
+  int count = 0;
+  for (int i = 0; i < 8; i++)
+  {
+    Pixel n = {p.x + nx[i], p.y + ny[i]};
+    if (im.at(n.x, n.y))
+      result[count++] = n;
+  }
+  // stable insertion sort by label, descending
+  for (int i = 1; i < count; i++)
+  {
+    Pixel p = result[i];
+    int label = im.at(p.x, p.y);
+    int j = i;
+    for (; j > 0 && im.at(result[j - 1].x, result[j - 1].y) < label; j--)
+      result[j] = result[j - 1];
+    result[j] = p;
+  }
+  return count;
+}
+
+/* walks the thinned image from an end (or any pixel of a loop) and builds the skeleton tree. Iterative version of
+   the recursive Vectorization.vectorizeRec, the frames visit the neighbours in the same order */
+class Vectorizer
+{
+public:
+  Vectorizer(Bitmap &im, const vector<Pixel> &ends, SkeletonTree &tree) : im(im), ends(ends), tree(tree) {}
+
+  // the root node, -1 if the image is empty
+  int run()
+  {
+    Pixel start;
+    if (ends.empty())
+    {
+      size_t i = 0;
+      while (i < im.size() && !im[i])
+        i++;
+      if (i == im.size())
+        return -1;
+      start.x = i % im.width();
+      start.y = i / im.width();
+    }
+    else
+      start = ends[0];
+
+    int root = tree.addNode(start, -1, tree.addPixels());
+    im(start.x, start.y) = VISITED;
+    pushFrame(FRAME_ROOT, root, -1, start);
+
+    while (!stack.empty())
+    {
+      Frame &f = stack.back();
+      if (f.next == f.count)
+      {
+        stack.pop_back();
+        continue;
+      }
+      Pixel n = f.neighbours[f.next++];
+      int label = im.at(n.x, n.y);
+      if (label < VISITED)
+      {
+        int node = f.node;
+        int pixels = f.pixels;
+        if (f.type == FRAME_ROOT)
+        {
+          pixels = tree.addPixels();
+          tree.pixels[pixels].push_back(tree.nodes[node].point);
+        }
+        else if (f.type == FRAME_CROSSING)
+          pixels = tree.addPixels();
+        visit(node, n, pixels); // invalidates f
+      }
+      else if (f.type == FRAME_LINE && label == VISITED_CROSSING && tree.pixels[f.pixels].size() > 1)
+        addLoop(f.node, n, f.pixels);
+    }
+    return root;
+  }
+
+private:
+  enum FrameType
+  {
+    FRAME_ROOT,     // start pixel, every neighbour gets a new pixel list with the start point
+    FRAME_CROSSING, // every neighbour gets a new pixel list
+    FRAME_LINE      // the neighbours continue the pixel list of the line, visited crossings close loops
+  };
+
+  struct Frame
+  {
+    FrameType type;
+    int node;   // parent of the nodes found from here
+    int pixels; // pixel list of FRAME_LINE
+    Pixel neighbours[8];
+    int count, next;
+  };
+
+  Bitmap &im;
+  const vector<Pixel> &ends;
+  SkeletonTree &tree;
+  vector<Frame> stack;
+
+  void pushFrame(FrameType type, int node, int pixels, Pixel p)
+  {
+    Frame f;
+    f.type = type;
+    f.node = node;
+    f.pixels = pixels;
+    f.count = neighbours(im, p, f.neighbours);
+    f.next = 0;
+    stack.push_back(f);
+  }
+
+  // Vectorization.vectorizeRec up to the loop over the neighbours
+  void visit(int node, Pixel p, int pixels)
+  {
+    tree.pixels[pixels].push_back(p);
+    int label = im(p.x, p.y);
+    if (label == SKELETON_CROSSING)
+    {
+      im(p.x, p.y) = VISITED_CROSSING;
+      Pixel np = tree.nodes[node].point;
+      int squareDist = (p.x - np.x) * (p.x - np.x) + (p.y - np.y) * (p.y - np.y);
+      if (squareDist > 4)
+        pushFrame(FRAME_CROSSING, tree.addNode(p, node, pixels), -1, p);
+      else
+      {
+        // crossings next to the node are merged into it
+        tree.pixels[tree.nodes[node].pixels].push_back(p);
+        im(np.x, np.y) = VISITED;
+        tree.nodes[node].point = p;
+        pushFrame(FRAME_CROSSING, node, -1, p);
+      }
+    }
+    else if (label == SKELETON_END)
+    {
+      im(p.x, p.y) = VISITED;
+      tree.addNode(p, node, pixels);
+    }
+    else if (label == SKELETON_LINE)
+    {
+      im(p.x, p.y) = VISITED;
+      pushFrame(FRAME_LINE, node, pixels, p);
+      Frame &f = stack.back();
+      if (f.count > 2)
+      {
+        // next to a crossing, pixels that are neighbours of the node belong to the crossing
+        Pixel nodeNeighbours[8];
+        int nodeCount = neighbours(im, tree.nodes[node].point, nodeNeighbours);
+        int count = 0;
+        for (int i = 0; i < f.count; i++)
+        {
+          if (std::find(nodeNeighbours, nodeNeighbours + nodeCount, f.neighbours[i]) == nodeNeighbours + nodeCount)
+            f.neighbours[count++] = f.neighbours[i];
+        }
+        f.count = count;
+      }
+      // O-shaped skeleton without ends
+      if (ends.empty() && f.count == 2 &&
+          im.at(f.neighbours[0].x, f.neighbours[0].y) == VISITED && im.at(f.neighbours[1].x, f.neighbours[1].y) == VISITED)
+        tree.addNode(p, node, pixels);
+    }
+  }
+
+  // the line reached an already visited crossing
+  void addLoop(int node, Pixel n, int pixels)
+  {
+    if (n == tree.nodes[node].point)
+    {
+      // loop to self, split at the middle (too small loops are ignored)
+      vector<Pixel> &line = tree.pixels[pixels];
+      if (line.size() >= 3)
+      {
+        size_t half = line.size() / 2;
+        Pixel center = line[half];
+        int first = tree.addPixels();
+        vector<Pixel> &firstHalf = tree.pixels[first];
+        vector<Pixel> &rest = tree.pixels[pixels];
+        firstHalf.assign(rest.begin(), rest.begin() + half);
+        rest.erase(rest.begin(), rest.begin() + half);
+        int loop = tree.addNode(center, node, first);
+        tree.nodes[node].loops.push_back(loop);
+      }
+    }
+    else
+    {
+      int loop = tree.addNode(n, node, pixels);
+      tree.nodes[node].loops.push_back(loop);
+    }
+  }
+};
+
+/* splits the edges to children whose middle pixel is further than deviation from the straight line
+   (Vectorization.subdivideTreeRec) */
+static void subdivideTree(SkeletonTree &tree, int n, double deviation)
+{
+  size_t count = tree.nodes[n].children.size();
+  for (size_t k = 0; k < count; k++)
+  {
+    int c = tree.nodes[n].children[k];
+    size_t length = tree.pixels[tree.nodes[c].pixels].size();
+    if (length > 10)
+    {
+      size_t idx = length / 2;
+      Pixel halfPoint = tree.pixels[tree.nodes[c].pixels][idx];
+      double x = halfPoint.x, y = halfPoint.y;
+      double x1 = tree.nodes[n].point.x, y1 = tree.nodes[n].point.y;
+      double x2 = tree.nodes[c].point.x, y2 = tree.nodes[c].point.y;
+      double dist;
+
+      // cross track error
+      double t = ((x - x1) * (x2 - x1) + (y - y1) * (y2 - y1)) /
+                 ((y2 - y1) * (y2 - y1) + (x2 - x1) * (x2 - x1));
+      if (t < 0)
+        dist = sqrt((x1 - x) * (x1 - x) + (y1 - y) * (y1 - y));
+      else if (t > 1)
+        dist = sqrt((x2 - x) * (x2 - x) + (y2 - y) * (y2 - y));
+      else
+        dist = ((y2 - y1) * x - (x2 - x1) * y + x2 * y1 - y2 * x1) /
+               sqrt((y2 - y1) * (y2 - y1) + (x2 - x1) * (x2 - x1));
+      dist = fabs(dist);
+      if (dist > deviation)
+      {
+        int first = tree.addPixels();
+        int second = tree.addPixels();
+        const vector<Pixel> &line = tree.pixels[tree.nodes[c].pixels];
+        tree.pixels[first].assign(line.begin(), line.begin() + idx + 1);
+        tree.pixels[second].assign(line.begin() + idx + 1, line.end());
+
+        int center = tree.addNode(halfPoint, -1, first);
+        tree.nodes[center].parent = n;
+        tree.nodes[center].children.push_back(c);
+        tree.nodes[c].pixels = second;
+
+        vector<int> &children = tree.nodes[n].children;
+        std::replace(children.begin(), children.end(), c, center);
+        tree.nodes[c].parent = center;
+
+        subdivideTree(tree, n, deviation);
+      }
+    }
+    subdivideTree(tree, c, deviation);
+  }
+  for (size_t k = 0; k < tree.nodes[n].loops.size(); k++)
+    subdivideTree(tree, tree.nodes[n].loops[k], deviation);
+}
+
+// a segment from every node to each of its children, depth first (Vectorization.segemntsFromTreeRec)
+static void collectSegments(SkeletonTree &tree, int n, SkeletonResult *result)
+{
+  const vector<int> children = tree.nodes[n].children;
+  for (size_t k = 0; k < children.size(); k++)
+  {
+    int c = children[k];
+    int s = result->segments.size() / 4;
+    result->segments.push_back(tree.nodes[n].point.x);
+    result->segments.push_back(tree.nodes[n].point.y);
+    result->segments.push_back(tree.nodes[c].point.x);
+    result->segments.push_back(tree.nodes[c].point.y);
+
+    tree.nodes[c].segment = s;
+    if (tree.nodes[n].parent >= 0)
+    {
+      int parentSegment = tree.nodes[n].segment;
+      int connections[] = {CONNECTED_12, s, parentSegment, CONNECTED_21, parentSegment, s};
+      result->connections.insert(result->connections.end(), connections, connections + 6);
+    }
+    collectSegments(tree, c, result);
+  }
+
+  // peers, every pair is added in both orders like the javascript did
+  for (size_t i = 0; i < children.size(); i++)
+  {
+    for (size_t j = 0; j < children.size(); j++)
+    {
+      if (i == j)
+        continue;
+      int si = tree.nodes[children[i]].segment, sj = tree.nodes[children[j]].segment;
+      int connections[] = {CONNECTED_11, si, sj, CONNECTED_11, sj, si};
+      result->connections.insert(result->connections.end(), connections, connections + 6);
+    }
+  }
+}
+
+//--------------------------------------------------------------------------
+//------------------------skeleton------------------------------------------
+//--------------------------------------------------------------------------
+void build_skeleton(int w, int h, unsigned char *rgba, double deviation, SkeletonResult *result)
+{
+  if (w < 0 || h < 0)
+    throw std::runtime_error("build_skeleton: invalid image size");
+  initNeighbourPatterns();
+  result->clear();
+
+  fixSmallPassages(rgba, w, h);
+
+  Bitmap im(w, h);
+  for (size_t i = 0; i < im.size(); i++)
+    im[i] = rgba[i * 4] || rgba[i * 4 + 1] || rgba[i * 4 + 2];
+
+  Thinning(im).run();
+  erodeKeepCrossings(im);
+
+  vector<Pixel> crossings, ends;
+  detectEndsAndCrossings(im, crossings, ends);
+  result->labels.resize(im.size());
+  for (size_t i = 0; i < im.size(); i++)
+    result->labels[i] = im[i];
+
+  SkeletonTree tree;
+  int root = Vectorizer(im, ends, tree).run();
+  if (root < 0)
+    return;
+  subdivideTree(tree, root, deviation);
+  collectSegments(tree, root, result);
+}
+
+// Binding code
+#ifdef __EMSCRIPTEN__
+/* Zero copy interface like the morph buffer api:
+     getSkeletonImageBuffer(w * h * 4).set(imageData.data);
+     let skeleton = computeSkeleton(w, h, deviation);
+   the image buffer holds the image with the fixed passages afterwards. The views point into the wasm memory,
+   they are only valid until the next call (or memory growth) */
+vector<unsigned char> skeletonImage;
+SkeletonResult skeletonResult;
+
+template <typename T>
+val view(const std::vector<T> &v)
+{
+  return val(typed_memory_view(v.size(), v.data()));
+}
+
+EMSCRIPTEN_KEEPALIVE val getSkeletonImageBuffer(int size)
+{
+  skeletonImage.resize(size);
+  return view(skeletonImage);
+}
+
+EMSCRIPTEN_KEEPALIVE val computeSkeleton(int w, int h, double deviation)
+{
+  if (skeletonImage.size() < (size_t)w * h * 4)
+    throw std::runtime_error("Image buffer smaller than w * h * 4");
+  build_skeleton(w, h, skeletonImage.data(), deviation, &skeletonResult);
+
+  val result = val::object();
+  result.set("numSegments", (int)skeletonResult.segments.size() / 4);
+  result.set("segments", view(skeletonResult.segments));
+  result.set("connections", view(skeletonResult.connections));
+  result.set("labels", view(skeletonResult.labels));
+  return result;
+}
+
+EMSCRIPTEN_BINDINGS(skeleton)
+{
+  emscripten::function("getSkeletonImageBuffer", &getSkeletonImageBuffer);
+  emscripten::function("computeSkeleton", &computeSkeleton);
+
+  constant("SKELETON_BACKGROUND", SKELETON_BACKGROUND);
+  constant("SKELETON_LINE", SKELETON_LINE);
+  constant("SKELETON_CROSSING", SKELETON_CROSSING);
+  constant("SKELETON_END", SKELETON_END);
+  constant("CONNECTED_11", CONNECTED_11);
+  constant("CONNECTED_12", CONNECTED_12);
+  constant("CONNECTED_21", CONNECTED_21);
+}
+#endif
@@ -0,0 +1,35 @@
+#ifndef _H_SKELETON
+#define _H_SKELETON
+
+#include <vector>
+
+// pixel labels of the skeleton result
+#define SKELETON_BACKGROUND 0
+#define SKELETON_LINE       1
+#define SKELETON_CROSSING   2
+#define SKELETON_END        3
+
+// connection lists of a site segment (SiteSegment.connected_11, connected_12, connected_21)
+#define CONNECTED_11 0
+#define CONNECTED_12 1
+#define CONNECTED_21 2
+
+// Site segments of the skeleton, segment j is segments[4j .. 4j+3]
+struct SkeletonResult {
+  std::vector<int> segments;            // x1, y1, x2, y2 per segment
+  std::vector<int> connections;         // list (CONNECTED_*), segment, connected segment; in the order javascript adds them
+  std::vector<unsigned char> labels;    // SKELETON_* per pixel of the thinned image
+
+  void clear() {
+    segments.clear();
+    connections.clear();
+    labels.clear();
+  }
+};
+
+/* Skeleton of the silhouette in the RGBA image (w * h pixels, black is background) as site segments, the same as
+   Vectorization.updateSkelleton. Small passages of the image are fixed in place like fixSmallPassages does,
+   segments that deviate more than deviation pixels from the skeleton are subdivided */
+void build_skeleton(int w, int h, unsigned char* rgba, double deviation, SkeletonResult* result);
+
+#endif
@@ -0,0 +1,97 @@
+// Checks of build_skeleton on small fixed silhouettes, run by ctest (native build only)
+#include "skeleton.h"
+#include <cstdio>
+#include <vector>
+#include <thread>
+
+using namespace std;
+
+int failures = 0;
+
+#define CHECK(cond)                                                   \
+  do                                                                  \
+  {                                                                   \
+    if (!(cond))                                                      \
+    {                                                                 \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                     \
+    }                                                                 \
+  } while (0)
+
+// white T on black: a bar over y 3..6, x 2..21 and a stem over y 7..13, x 10..13
+vector<unsigned char> makeT(int w, int h)
+{
+  vector<unsigned char> rgba((size_t)w * h * 4);
+  for (int y = 0; y < h; y++)
+    for (int x = 0; x < w; x++)
+    {
+      size_t i = ((size_t)y * w + x) * 4;
+      bool inside = (y >= 3 && y <= 6 && x >= 2 && x <= 21) || (y >= 7 && y <= 13 && x >= 10 && x <= 13);
+      rgba[i] = rgba[i + 1] = rgba[i + 2] = inside ? 255 : 0;
+      rgba[i + 3] = 255;
+    }
+  return rgba;
+}
+
+// the T gives the three arms meeting at the crossing (11, 4), the same segments and connections as
+// Vectorization.updateSkelleton
+void testT()
+{
+  vector<unsigned char> rgba = makeT(24, 16);
+  SkeletonResult result;
+  build_skeleton(24, 16, rgba.data(), 1, &result);
+
+  int segments[] = {4, 4, 11, 4, 11, 4, 11, 11, 11, 4, 19, 4};
+  CHECK(result.segments == vector<int>(segments, segments + 12));
+  int connections[] = {CONNECTED_12, 1, 0, CONNECTED_21, 0, 1,
+                       CONNECTED_12, 2, 0, CONNECTED_21, 0, 2,
+                       CONNECTED_11, 1, 2, CONNECTED_11, 2, 1,
+                       CONNECTED_11, 2, 1, CONNECTED_11, 1, 2};
+  CHECK(result.connections == vector<int>(connections, connections + 24));
+  CHECK(result.labels.size() == (size_t)24 * 16);
+  CHECK(result.labels[4 * 24 + 11] == SKELETON_CROSSING);
+  CHECK(result.labels[4 * 24 + 4] == SKELETON_END);
+  CHECK(result.labels[0] == SKELETON_BACKGROUND);
+}
+
+// an image without a silhouette has no segments
+void testEmpty()
+{
+  vector<unsigned char> rgba((size_t)16 * 16 * 4, 0);
+  SkeletonResult result;
+  build_skeleton(16, 16, rgba.data(), 1, &result);
+  CHECK(result.segments.empty());
+  CHECK(result.connections.empty());
+}
+
+// concurrent first calls all see the complete neighbour pattern table
+void testConcurrent()
+{
+  vector<SkeletonResult> results(4);
+  vector<thread> threads;
+  for (size_t k = 0; k < results.size(); k++)
+    threads.push_back(thread([&results, k]()
+                             {
+                               vector<unsigned char> rgba = makeT(24, 16);
+                               build_skeleton(24, 16, rgba.data(), 1, &results[k]); }));
+  for (size_t k = 0; k < threads.size(); k++)
+    threads[k].join();
+  for (size_t k = 1; k < results.size(); k++)
+  {
+    CHECK(results[k].segments == results[0].segments);
+    CHECK(results[k].connections == results[0].connections);
+  }
+}
+
+int main()
+{
+  testConcurrent();
+  testT();
+  testEmpty();
+
+  if (failures)
+    printf("%d checks failed\n", failures);
+  else
+    printf("all checks passed\n");
+  return failures ? 1 : 0;
+}
@@ -8,18 +8,27 @@
 // See http://www.boost.org for updates, documentation, and revision history.
 // Modified by Julian Eder
 
+#ifdef __EMSCRIPTEN__
 #include <emscripten/bind.h>
 using namespace emscripten;
+#else
+#define EMSCRIPTEN_KEEPALIVE
+#endif
 
 
 #include <cstdio>
+#include <cmath>
 #include <vector>
 #include <algorithm>
+#include <map>
+#include <stdexcept>
 
 
 #include <boost/polygon/voronoi.hpp>
 #include <boost/polygon/polygon.hpp>
 
+#include "voronoi.h"
+
 using boost::polygon::voronoi_builder;
 using boost::polygon::voronoi_diagram;
 using boost::polygon::x;
@@ -46,12 +55,12 @@ typedef VD::const_vertex_iterator const_vertex_iterator;
 typedef VD::const_edge_iterator const_edge_iterator;
 
 
-struct Point {
+struct SitePoint {
   int a;
   int b;
-  Point(int x, int y) : a(x), b(y) {}
-  const int x(){ return a; }
-  const int y(){ return b; }
+  SitePoint(int x, int y) : a(x), b(y) {}
+  int x() const { return a; }
+  int y() const { return b; }
 
   inline bool operator==(point_type& rhs) {
     return x() == ((int)round(rhs.x())) && y() == ((int)round(rhs.y()));
@@ -59,82 +68,98 @@ struct Point {
 
 };
 
-struct Segment {
-  Point p0;
-  Point p1;
-  Segment(int x1, int y1, int x2, int y2) : p0(x1, y1), p1(x2, y2) {}
+struct SiteSegment {
+  SitePoint p0;
+  SitePoint p1;
+  SiteSegment(int x1, int y1, int x2, int y2) : p0(x1, y1), p1(x2, y2) {}
 };
 
 namespace boost {
   namespace polygon {
 
     template <>
-    struct geometry_concept<Point> {
+    struct geometry_concept<SitePoint> {
       typedef point_concept type;
     };
 
     template <>
-    struct point_traits<Point> {
+    struct point_traits<SitePoint> {
       typedef int coordinate_type;
 
       static inline coordinate_type get(
-          const Point& point, orientation_2d orient) {
+          const SitePoint& point, orientation_2d orient) {
         return (orient == HORIZONTAL) ? point.a : point.b;
       }
     };
 
     template <>
-    struct geometry_concept<Segment> {
+    struct geometry_concept<SiteSegment> {
       typedef segment_concept type;
     };
 
     template <>
-    struct segment_traits<Segment> {
+    struct segment_traits<SiteSegment> {
       typedef int coordinate_type;
-      typedef Point point_type;
+      typedef SitePoint point_type;
 
-      static inline point_type get(const Segment& segment, direction_1d dir) {
+      static inline point_type get(const SiteSegment& segment, direction_1d dir) {
         return dir.to_int() ? segment.p1 : segment.p0;
       }
     };
   }  // polygon
 }  // boost
   
-struct CellResult {
-  size_t source_index;
-  int source_category;
-  bool is_degenerate;
-  bool contains_point;
-  bool contains_segment;
-  std::vector<int> edge_indices;
-  int color;
-  int tile_idx;
-};
-
-struct EdgeResult {
-  double x1;
-  double y1;
-  double x2;
-  double y2;
-  bool isFinite;
-  bool isCurved;
-  bool isPrimary;
-  bool isWithinCell;
-  const voronoi_diagram<double>::edge_type* edge_ref; // not for javascript
-  std::vector<double> controll_points;
+// everything the edge clipping needs, passed by reference so no site list is copied per edge
+// the output goes either to result or (if set) to the flat result
+struct ClipContext {
+  const std::vector<SitePoint>& pointSites;
+  const std::vector<SiteSegment>& lineSites;
+  double xl, yl, xh, yh; // bbox
+  DiagrammResult* result;
+  FlatDiagrammResult* flat;
+  int numEdges;
+  std::vector<point_type> controll_points; // reused for every curved edge
+
+  ClipContext(const std::vector<SitePoint>& pointSites, const std::vector<SiteSegment>& lineSites,
+              const std::vector<double>& bbox, DiagrammResult* result, FlatDiagrammResult* flat)
+    : pointSites(pointSites), lineSites(lineSites),
+      xl(bbox[0]), yl(bbox[1]), xh(bbox[2]), yh(bbox[3]), result(result), flat(flat), numEdges(0) {}
 };
 
-struct DiagrammResult {
-  std::vector<double> vertices;
-  std::vector<EdgeResult> edges;
-  std::vector<CellResult> cells;
-  int numVerticies;
-};
+// appends the clipped edge and the control points in ctx.controll_points to the output
+void add_edge(ClipContext& ctx, EdgeResult* edgeResult) {
+  if (ctx.flat) {
+    FlatDiagrammResult& flat = *ctx.flat;
+    flat.edgeCoords.push_back(edgeResult->x1);
+    flat.edgeCoords.push_back(edgeResult->y1);
+    flat.edgeCoords.push_back(edgeResult->x2);
+    flat.edgeCoords.push_back(edgeResult->y2);
+    flat.edgeFlags.push_back(
+      (edgeResult->isFinite ? EDGE_FINITE : 0) |
+      (edgeResult->isCurved ? EDGE_CURVED : 0) |
+      (edgeResult->isPrimary ? EDGE_PRIMARY : 0) |
+      (edgeResult->isWithinCell ? EDGE_WITHIN_CELL : 0));
+    for (size_t i = 0; i < ctx.controll_points.size(); i++)
+    {
+      flat.controlPoints.push_back(ctx.controll_points[i].x());
+      flat.controlPoints.push_back(ctx.controll_points[i].y());
+    }
+    flat.controlPointOffsets.push_back(flat.controlPoints.size());
+  } else {
+    for (size_t i = 0; i < ctx.controll_points.size(); i++)
+    {
+      edgeResult->controll_points.push_back(ctx.controll_points[i].x());
+      edgeResult->controll_points.push_back(ctx.controll_points[i].y());
+    }
+    ctx.result->edges.push_back(*edgeResult);
+  }
+  ctx.numEdges++;
+}
 
-Point retrieve_point(
+SitePoint retrieve_point(
   const voronoi_diagram<double>::cell_type* cell,
-  std::vector<Point> pointSites,
-  std::vector<Segment> lineSites
+  const std::vector<SitePoint>& pointSites,
+  const std::vector<SiteSegment>& lineSites
   ) {
   voronoi_diagram<double>::cell_type::source_index_type index = cell->source_index();
   voronoi_diagram<double>::cell_type::source_category_type category = cell->source_category();
@@ -149,13 +174,13 @@ Point retrieve_point(
   }
 }
 
-Segment retrieve_segment(const cell_type* cell, std::vector<Point> pointSites, std::vector<Segment> lineSites) {
+SiteSegment retrieve_segment(const cell_type* cell, const std::vector<SitePoint>& pointSites, const std::vector<SiteSegment>& lineSites) {
   source_index_type index = cell->source_index() - pointSites.size();
   return lineSites[index];
 }
 
 double get_point_projection(
-      const point_type& point, const Segment& segment, bool verbose = false) {
+      const point_type& point, const SiteSegment& segment) {
 
     double segment_vec_x = x(high(segment)) - x(low(segment));
     double segment_vec_y = y(high(segment)) - y(low(segment));
@@ -179,8 +204,8 @@ static double parabola_deriv_y(double x, double a, double b) {
 }
 
 void calc_control_points(
-  Point& point,
-  Segment& segment,
+  SitePoint& point,
+  SiteSegment& segment,
   std::vector<point_type>* control_points)
 {
     // Save the first and last point.
@@ -275,67 +300,62 @@ void createVertex(
 }
 
 
-bool clip_add_finite_edge(
-  const voronoi_diagram<double>::edge_type& edge,
-  DiagrammResult* result,
-  EdgeResult* edgeResult,
-  std::vector<Point> pointSites,
-  std::vector<Segment> lineSites,
-  std::vector<double> bbox,
-  int i
+// clips the line (x0, y0) - (x1, y1) to the bbox of ctx into edgeResult, false if it is completely outside
+bool clip_line(
+  double x0, double y0, double x1, double y1,
+  const ClipContext& ctx,
+  EdgeResult* edgeResult
   ) {
-
-  std::vector<point_type> controll_points_;
-  double xl = bbox[0];
-  double xh = bbox[2];
-  double yl = bbox[1];
-  double yh = bbox[3];
+  double xl = ctx.xl;
+  double xh = ctx.xh;
+  double yl = ctx.yl;
+  double yh = ctx.yh;
 
   // completely outside
-  if((edge.vertex0()->x() <= xl && edge.vertex1()->x() <= xl)
-  || (edge.vertex0()->x() >= xh && edge.vertex1()->x() >= xh)
-  || (edge.vertex0()->y() <= yl && edge.vertex1()->y() <= yl)
-  || (edge.vertex0()->y() >= yh && edge.vertex1()->y() >= yh)){
+  if((x0 <= xl && x1 <= xl)
+  || (x0 >= xh && x1 >= xh)
+  || (y0 <= yl && y1 <= yl)
+  || (y0 >= yh && y1 >= yh)){
     return false;
   }
 
 
   point_type direction;
-  direction.x(edge.vertex1()->x() - edge.vertex0()->x());
-  direction.y(edge.vertex1()->y() - edge.vertex0()->y());
+  direction.x(x1 - x0);
+  direction.y(y1 - y0);
 
-  if(isnan(direction.x()) || isnan(direction.y()))
+  if(std::isnan(direction.x()) || std::isnan(direction.y()))
     return false;
 
   double dxdy = direction.x() / direction.y();
   double dydx = direction.y() / direction.x();
 
   // Clip X1
-  if(edge.vertex0()->x() < xl){
-    edgeResult->x1 = edge.vertex0()->x() + (xl - edge.vertex0()->x()) ;
-    edgeResult->y1 = edge.vertex0()->y() + (xl - edge.vertex0()->x()) * dydx;
+  if(x0 < xl){
+    edgeResult->x1 = x0 + (xl - x0) ;
+    edgeResult->y1 = y0 + (xl - x0) * dydx;
   }
-  else if(edge.vertex0()->x() > xh){
-    edgeResult->x1 = edge.vertex0()->x() + (xh - edge.vertex0()->x());
-    edgeResult->y1 = edge.vertex0()->y() + (xh - edge.vertex0()->x()) * dydx;
+  else if(x0 > xh){
+    edgeResult->x1 = x0 + (xh - x0);
+    edgeResult->y1 = y0 + (xh - x0) * dydx;
   }
   else {
-    edgeResult->x1 = edge.vertex0()->x();
-    edgeResult->y1 = edge.vertex0()->y();
+    edgeResult->x1 = x0;
+    edgeResult->y1 = y0;
   }
 
   // Clip X2
-  if(edge.vertex1()->x() < xl){
-    edgeResult->x2 = edge.vertex1()->x() + (xl - edge.vertex1()->x());
-    edgeResult->y2 = edge.vertex1()->y() + (xl - edge.vertex1()->x()) * dydx;
+  if(x1 < xl){
+    edgeResult->x2 = x1 + (xl - x1);
+    edgeResult->y2 = y1 + (xl - x1) * dydx;
   }
-  else if(edge.vertex1()->x() > xh){
-    edgeResult->x2 = edge.vertex1()->x() + (xh - edge.vertex1()->x());
-    edgeResult->y2 = edge.vertex1()->y() + (xh - edge.vertex1()->x()) * dydx;
+  else if(x1 > xh){
+    edgeResult->x2 = x1 + (xh - x1);
+    edgeResult->y2 = y1 + (xh - x1) * dydx;
   }
   else {
-    edgeResult->x2 = edge.vertex1()->x();
-    edgeResult->y2 = edge.vertex1()->y();
+    edgeResult->x2 = x1;
+    edgeResult->y2 = y1;
   }
 
   // Clip Y1
@@ -359,46 +379,103 @@ bool clip_add_finite_edge(
     edgeResult->y2 = edgeResult->y2 + (yh - edgeResult->y2);
   }
 
+  return true;
+}
+
+bool clip_add_finite_edge(
+  const voronoi_diagram<double>::edge_type& edge,
+  ClipContext& ctx,
+  EdgeResult* edgeResult
+  ) {
+
+  std::vector<point_type>& controll_points_ = ctx.controll_points;
+  controll_points_.clear();
+
+  if (!clip_line(edge.vertex0()->x(), edge.vertex0()->y(), edge.vertex1()->x(), edge.vertex1()->y(), ctx, edgeResult))
+    return false;
 
   if (edge.is_curved()) { // only finite edges can be curved
     controll_points_.push_back(point_type(edgeResult->x1, edgeResult->y1));
     controll_points_.push_back(point_type(edgeResult->x2, edgeResult->y2));
-    Point point = edge.cell()->contains_point() ?
-      retrieve_point(edge.cell(), pointSites, lineSites) :
-      retrieve_point(edge.twin()->cell(), pointSites, lineSites);
-    Segment segment = edge.cell()->contains_point() ?
-      retrieve_segment(edge.twin()->cell(), pointSites, lineSites) :
-      retrieve_segment(edge.cell(), pointSites, lineSites);
+    SitePoint point = edge.cell()->contains_point() ?
+      retrieve_point(edge.cell(), ctx.pointSites, ctx.lineSites) :
+      retrieve_point(edge.twin()->cell(), ctx.pointSites, ctx.lineSites);
+    SiteSegment segment = edge.cell()->contains_point() ?
+      retrieve_segment(edge.twin()->cell(), ctx.pointSites, ctx.lineSites) :
+      retrieve_segment(edge.cell(), ctx.pointSites, ctx.lineSites);
     calc_control_points(point, segment, &controll_points_);
   }
 
-  for (size_t i = 0; i < controll_points_.size(); i++)
-  {
-    edgeResult->controll_points.push_back(controll_points_[i].x());
-    edgeResult->controll_points.push_back(controll_points_[i].y());
-  }
-  result->edges.push_back(*edgeResult);
+  add_edge(ctx, edgeResult);
   return true;
 }
 
+// origin and unit direction of the ray along an infinite edge, false if the direction is undefined
+bool infinite_edge_ray(
+  const voronoi_diagram<double>::edge_type& edge,
+  const ClipContext& ctx,
+  point_type* origin,
+  point_type* direction
+  ) {
+    bool vertex0isZero = (edge.vertex0() == NULL) && (edge.vertex1() != NULL);
+
+    const voronoi_diagram<double>::cell_type* cell1 = edge.cell();
+    const voronoi_diagram<double>::cell_type* cell2 = edge.twin()->cell();
+    if(vertex0isZero){
+      cell1 = edge.twin()->cell();
+      cell2 = edge.cell();
+    }
+
+    // Infinite edges could not be created by two segment sites.
+    if (cell1->contains_point() && cell2->contains_point()) {
+      SitePoint p1 = retrieve_point(cell1, ctx.pointSites, ctx.lineSites);
+      SitePoint p2 = retrieve_point(cell2, ctx.pointSites, ctx.lineSites);
+      origin->x((p1.x() + p2.x()) * 0.5);
+      origin->y((p1.y() + p2.y()) * 0.5);
+      direction->x(p1.y() - p2.y()); // orthogonal to the direction between the points
+      direction->y(p2.x() - p1.x());
+    } else {
+      *origin = cell1->contains_segment() ?
+          retrieve_point(cell2, ctx.pointSites, ctx.lineSites) :
+          retrieve_point(cell1, ctx.pointSites, ctx.lineSites);
+      SiteSegment segment = cell1->contains_segment() ?
+          retrieve_segment(cell1, ctx.pointSites, ctx.lineSites) :
+          retrieve_segment(cell2, ctx.pointSites, ctx.lineSites);
+      coordinate_type dx = high(segment).x() - low(segment).x();
+      coordinate_type dy = high(segment).y() - low(segment).y();
+      if ((low(segment) == *origin) ^ cell1->contains_point()) {
+        direction->x(dy);
+        direction->y(-dx);
+      } else {
+        direction->x(-dy);
+        direction->y(dx);
+      }
+    }
+
+    if(std::isnan(direction->x()) || std::isnan(direction->y())){
+      return false;
+    }
+
+    //normalize
+    double l = sqrt(direction->x()*direction->x() + direction->y()*direction->y());
+    direction->x(direction->x() / l);
+    direction->y(direction->y() / l);
+
+    return true;
+}
+
 bool clip_add_infinite_edge(
   const voronoi_diagram<double>::edge_type& edge,
-  DiagrammResult* result,
-  EdgeResult* edgeResult,
-  std::vector<Point> pointSites,
-  std::vector<Segment> lineSites,
-  std::vector<double> bbox,
-  int i
+  ClipContext& ctx,
+  EdgeResult* edgeResult
   ) {
     // vertex - voronoi vertex from which the voronoi edge starts
     // p1, p2 - sitePoints that the edge is equal distance from
 
-    double xl = bbox[0];
-    double xh = bbox[2];
-    double yl = bbox[1];
-    double yh = bbox[3];
-
-    bool vertex0isZero = false;
+    double xl = ctx.xl;
+    double xh = ctx.xh;
+    double yl = ctx.yl;
+    double yh = ctx.yh;
 
     // completely outside (we assume that the edge goes outwards from the bbox and therefore is not visible if the finite start point is inside the bbox)
     if((edge.vertex0() != NULL) && (edge.vertex1() == NULL)){
@@ -410,7 +487,6 @@ bool clip_add_infinite_edge(
       }
     }
     if((edge.vertex0() == NULL) && (edge.vertex1() != NULL)){
-      vertex0isZero = true;
       if((edge.vertex1()->x() <= xl)
       || (edge.vertex1()->x() >= xh)
       || (edge.vertex1()->y() <= yl)
@@ -419,51 +495,11 @@ bool clip_add_infinite_edge(
       }
     }
 
-    const voronoi_diagram<double>::cell_type* cell1 = edge.cell();
-    const voronoi_diagram<double>::cell_type* cell2 = edge.twin()->cell();
-    if(vertex0isZero){
-      cell1 = edge.twin()->cell();
-      cell2 = edge.cell();
-    }
-
     point_type origin, direction;
-    // Infinite edges could not be created by two segment sites.
-    if (cell1->contains_point() && cell2->contains_point()) {
-      Point p1 = retrieve_point(cell1, pointSites, lineSites);
-      Point p2 = retrieve_point(cell2, pointSites, lineSites);
-      origin.x((p1.x() + p2.x()) * 0.5);
-      origin.y((p1.y() + p2.y()) * 0.5);
-      direction.x(p1.y() - p2.y()); // orthogonal to the direction between the points
-      direction.y(p2.x() - p1.x());
-    } else {
-      origin = cell1->contains_segment() ?
-          retrieve_point(cell2, pointSites, lineSites) :
-          retrieve_point(cell1, pointSites, lineSites);
-      Segment segment = cell1->contains_segment() ?
-          retrieve_segment(cell1, pointSites, lineSites) :
-          retrieve_segment(cell2, pointSites, lineSites);
-      coordinate_type dx = high(segment).x() - low(segment).x();
-      coordinate_type dy = high(segment).y() - low(segment).y();
-      if ((low(segment) == origin) ^ cell1->contains_point()) {
-        direction.x(dy);
-        direction.y(-dx);
-      } else {
-        direction.x(-dy);
-        direction.y(dx);
-      }
-    }
-
-    if(isnan(direction.x()) || isnan(direction.y())){
+    if(!infinite_edge_ray(edge, ctx, &origin, &direction)){
       return false;
     }
 
-    //normalize
-    double l = sqrt(direction.x()*direction.x() + direction.y()*direction.y());
-    direction.x(direction.x() / l);
-    direction.y(direction.y() / l);
-
-    double fm, fb;
-
     if(direction.x() == 0){ // Vertical
       // doesn't intersect with viewport
       if (origin.x() < xl || origin.x() > xh) {
@@ -510,39 +546,308 @@ bool clip_add_infinite_edge(
         createVertex(edge, edgeResult, cx, cy);
       }
     }
-    result->edges.push_back(*edgeResult);
+    ctx.controll_points.clear();
+    add_edge(ctx, edgeResult);
     return true;
 }
 
-EMSCRIPTEN_KEEPALIVE DiagrammResult compute(
-  std::vector<double> bbox, std::vector<int> points, 
-  std::vector<int> segments, 
-  std::vector<int> pointColors, 
-  std::vector<int> segmentColors,
-  std::vector<int> pointTileIdxs,
-  std::vector<int> segmentTileIdxs
-  ) {
-  std::vector<Point> pointSites;
-  std::vector<Segment> lineSites;
+// the boost source category as number for javascript
+int source_category(const cell_type& cell) {
+  switch(cell.source_category()){
+    case boost::polygon::SOURCE_CATEGORY_SINGLE_POINT:
+      return 0;
+    case boost::polygon::SOURCE_CATEGORY_SEGMENT_START_POINT:
+      return 1;
+    case boost::polygon::SOURCE_CATEGORY_SEGMENT_END_POINT:
+      return 2;
+
+    // Segment subtypes.
+    case boost::polygon::SOURCE_CATEGORY_INITIAL_SEGMENT:
+      return 3;
+    case boost::polygon::SOURCE_CATEGORY_REVERSE_SEGMENT:
+      return 4;
+    case boost::polygon::SOURCE_CATEGORY_GEOMETRY_SHIFT:
+      return 5;
+    case boost::polygon::SOURCE_CATEGORY_BITMASK:
+      return 6;
+  }
+
+  return 0;
+}
+
+// appends the cell to the output, the edge indices of the flat result are added separately
+void add_cell(ClipContext& ctx, const CellResult& cellResult) {
+  if (ctx.flat) {
+    FlatDiagrammResult& flat = *ctx.flat;
+    flat.cellSourceIndices.push_back(cellResult.source_index);
+    flat.cellSourceCategories.push_back(cellResult.source_category);
+    flat.cellFlags.push_back(
+      (cellResult.is_degenerate ? CELL_DEGENERATE : 0) |
+      (cellResult.contains_point ? CELL_CONTAINS_POINT : 0) |
+      (cellResult.contains_segment ? CELL_CONTAINS_SEGMENT : 0));
+    flat.cellColors.push_back(cellResult.color);
+    flat.cellTileIdxs.push_back(cellResult.tile_idx);
+  } else {
+    ctx.result->cells.push_back(cellResult);
+  }
+}
+
+// segment cells are indexed after all point sites
+int cell_tile_idx(
+  const cell_type* cell,
+  const std::vector<int>& pointTileIdxs,
+  const std::vector<int>& segmentTileIdxs,
+  size_t numPoints) {
+  if (cell->source_category() == boost::polygon::SOURCE_CATEGORY_SINGLE_POINT)
+    return pointTileIdxs[cell->source_index()];
+  return segmentTileIdxs[cell->source_index() - numPoints];
+}
+
+//--------------------------------------------------------------------------------------------------
+//--------------------------site culling------------------------------------------------------------
+//--------------------------------------------------------------------------------------------------
+/* Sites further than a margin from the bbox are dropped before construct_voronoi. The clipped diagram stays the same
+   as long as every point of the bbox is closer than margin to its own site, that is checked on the diagram of the
+   remaining sites and the margin is doubled until it holds. */
+
+// the sites passed to construct_voronoi, sourceIndex maps them back to the input (points first, then segments)
+struct SiteSet {
+  std::vector<SitePoint> pointSites;
+  std::vector<SiteSegment> lineSites;
+  std::vector<int> pointColors, segmentColors;
+  std::vector<int> pointTileIdxs, segmentTileIdxs;
+  std::vector<size_t> sourceIndex;
+};
+
+static double point_segment_distance(const point_type& p, const SiteSegment& s) {
+  double sx = s.p0.a, sy = s.p0.b;
+  double dx = s.p1.a - sx, dy = s.p1.b - sy;
+  double l2 = dx * dx + dy * dy;
+  double t = l2 > 0 ? ((p.x() - sx) * dx + (p.y() - sy) * dy) / l2 : 0;
+  t = std::max(0.0, std::min(1.0, t));
+  double ex = sx + t * dx - p.x(), ey = sy + t * dy - p.y();
+  return sqrt(ex * ex + ey * ey);
+}
+
+// distance of the box [xl, xh] x [yl, yh] to the bbox
+static double bbox_distance(const std::vector<double>& bbox, double xl, double yl, double xh, double yh) {
+  double dx = std::max(0.0, std::max(xl - bbox[2], bbox[0] - xh));
+  double dy = std::max(0.0, std::max(yl - bbox[3], bbox[1] - yh));
+  return sqrt(dx * dx + dy * dy);
+}
+
+// twice the largest tile, the sites of the neighbouring tiles are within it
+static double culling_margin(
+  const std::vector<int>& points,
+  const std::vector<int>& segments,
+  const std::vector<int>& pointTileIdxs,
+  const std::vector<int>& segmentTileIdxs) {
+  std::map<int, std::vector<double> > extents; // xl, yl, xh, yh per tile
+  for (size_t i = 0; i < points.size(); i += 2) {
+    std::vector<double>& e = extents[pointTileIdxs[i / 2]];
+    if (e.empty())
+      e.assign({HUGE_VAL, HUGE_VAL, -HUGE_VAL, -HUGE_VAL});
+    e[0] = std::min(e[0], (double)points[i]);
+    e[1] = std::min(e[1], (double)points[i+1]);
+    e[2] = std::max(e[2], (double)points[i]);
+    e[3] = std::max(e[3], (double)points[i+1]);
+  }
+  for (size_t i = 0; i < segments.size(); i += 2) { // both end points
+    std::vector<double>& e = extents[segmentTileIdxs[i / 4]];
+    if (e.empty())
+      e.assign({HUGE_VAL, HUGE_VAL, -HUGE_VAL, -HUGE_VAL});
+    e[0] = std::min(e[0], (double)segments[i]);
+    e[1] = std::min(e[1], (double)segments[i+1]);
+    e[2] = std::max(e[2], (double)segments[i]);
+    e[3] = std::max(e[3], (double)segments[i+1]);
+  }
+  double margin = 1;
+  for (std::map<int, std::vector<double> >::const_iterator it = extents.begin(); it != extents.end(); ++it) {
+    const std::vector<double>& e = it->second;
+    margin = std::max(margin, 2 * sqrt((e[2] - e[0]) * (e[2] - e[0]) + (e[3] - e[1]) * (e[3] - e[1])));
+  }
+  return margin;
+}
+
+// fills sites with the input sites closer than margin to the bbox, false if none was dropped
+static bool cull_sites(
+  const std::vector<double>& bbox, const std::vector<int>& points,
+  const std::vector<int>& segments,
+  const std::vector<int>& pointColors,
+  const std::vector<int>& segmentColors,
+  const std::vector<int>& pointTileIdxs,
+  const std::vector<int>& segmentTileIdxs,
+  double margin,
+  SiteSet* sites) {
+  *sites = SiteSet();
+  for (size_t i = 0; i < points.size(); i += 2) {
+    if (bbox_distance(bbox, points[i], points[i+1], points[i], points[i+1]) > margin)
+      continue;
+    sites->pointSites.push_back(SitePoint(points[i], points[i+1]));
+    sites->pointColors.push_back(pointColors[i / 2]);
+    sites->pointTileIdxs.push_back(pointTileIdxs[i / 2]);
+    sites->sourceIndex.push_back(i / 2);
+  }
+  for (size_t i = 0; i < segments.size(); i += 4) {
+    if (bbox_distance(bbox, std::min(segments[i], segments[i+2]), std::min(segments[i+1], segments[i+3]),
+                      std::max(segments[i], segments[i+2]), std::max(segments[i+1], segments[i+3])) > margin)
+      continue;
+    sites->lineSites.push_back(SiteSegment(segments[i], segments[i+1], segments[i+2], segments[i+3]));
+    sites->segmentColors.push_back(segmentColors[i / 4]);
+    sites->segmentTileIdxs.push_back(segmentTileIdxs[i / 4]);
+    sites->sourceIndex.push_back(points.size() / 2 + i / 4);
+  }
+  return sites->sourceIndex.size() < points.size() / 2 + segments.size() / 4;
+}
+
+// distance of p to the site of cell
+static double site_distance(const cell_type* cell, const point_type& p, const ClipContext& ctx) {
+  if (cell->contains_segment())
+    return point_segment_distance(p, retrieve_segment(cell, ctx.pointSites, ctx.lineSites));
+  SitePoint site = retrieve_point(cell, ctx.pointSites, ctx.lineSites);
+  return euclidean_distance(p, point_type(site.a, site.b));
+}
 
-  for (size_t i = 0; i < points.size(); i += 2)
-  {
-      pointSites.push_back(Point(points[i], points[i+1]));
+// bbox (xl, yl, xh, yh) of a finite edge, curved edges are within the triangle of their control points
+static std::vector<double> edge_bounds(const edge_type& edge, const ClipContext& ctx) {
+  std::vector<point_type> controll_points;
+  controll_points.push_back(point_type(edge.vertex0()->x(), edge.vertex0()->y()));
+  controll_points.push_back(point_type(edge.vertex1()->x(), edge.vertex1()->y()));
+  if (edge.is_curved()) {
+    SitePoint point = edge.cell()->contains_point() ?
+      retrieve_point(edge.cell(), ctx.pointSites, ctx.lineSites) :
+      retrieve_point(edge.twin()->cell(), ctx.pointSites, ctx.lineSites);
+    SiteSegment segment = edge.cell()->contains_point() ?
+      retrieve_segment(edge.twin()->cell(), ctx.pointSites, ctx.lineSites) :
+      retrieve_segment(edge.cell(), ctx.pointSites, ctx.lineSites);
+    calc_control_points(point, segment, &controll_points);
+  }
+  std::vector<double> bounds = {HUGE_VAL, HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+  for (size_t i = 0; i < controll_points.size(); i++) {
+    bounds[0] = std::min(bounds[0], controll_points[i].x());
+    bounds[1] = std::min(bounds[1], controll_points[i].y());
+    bounds[2] = std::max(bounds[2], controll_points[i].x());
+    bounds[3] = std::max(bounds[3], controll_points[i].y());
+  }
+  return bounds;
+}
+
+/* true if no dropped site (all further than margin from the bbox) could own a point of the bbox.
+   The distance to the own site is convex along straight edges and grows with the distance to the apex along parabolic
+   ones, so it is largest in the vertices of the cells clipped to the bbox: the ends of the edges and the bbox corners. */
+static bool culling_is_exact(const voronoi_diagram<double>& vd, const ClipContext& ctx, double margin) {
+  double bboxDiagonal = euclidean_distance(point_type(ctx.xl, ctx.yl), point_type(ctx.xh, ctx.yh));
+  point_type bboxCenter((ctx.xl + ctx.xh) / 2, (ctx.yl + ctx.yh) / 2);
+
+  for (voronoi_diagram<double>::const_edge_iterator it = vd.edges().begin(); it != vd.edges().end(); ++it) {
+    const edge_type& edge = *it;
+    if (edge.is_finite()) {
+      point_type v0(edge.vertex0()->x(), edge.vertex0()->y());
+      point_type v1(edge.vertex1()->x(), edge.vertex1()->y());
+      if (std::max(site_distance(edge.cell(), v0, ctx), site_distance(edge.cell(), v1, ctx)) < margin)
+        continue;
+
+      EdgeResult clipped;
+      if (!edge.is_curved()) {
+        if (clip_line(v0.x(), v0.y(), v1.x(), v1.y(), ctx, &clipped) &&
+            std::max(site_distance(edge.cell(), point_type(clipped.x1, clipped.y1), ctx),
+                     site_distance(edge.cell(), point_type(clipped.x2, clipped.y2), ctx)) >= margin)
+          return false;
+        continue;
+      }
+
+      std::vector<double> bounds = edge_bounds(edge, ctx);
+      if (!(bounds[0] > ctx.xh || bounds[2] < ctx.xl || bounds[1] > ctx.yh || bounds[3] < ctx.yl))
+        return false;
+      continue;
+    }
+
+    // infinite edges are clipped from their vertex, edges that start outside of the bbox are dropped by
+    // clip_add_infinite_edge and might be finite in the complete diagram
+    point_type origin, direction;
+    if (!infinite_edge_ray(edge, ctx, &origin, &direction))
+      continue;
+    const voronoi_diagram<double>::vertex_type* vertex = edge.vertex0() ? edge.vertex0() : edge.vertex1();
+    point_type start = vertex ? point_type(vertex->x(), vertex->y()) : origin;
+    double l = euclidean_distance(start, bboxCenter) + bboxDiagonal;
+    if (!vertex)
+      start = point_type(start.x() - l * direction.x(), start.y() - l * direction.y()), l *= 2;
+    EdgeResult clipped;
+    if (!clip_line(start.x(), start.y(), start.x() + l * direction.x(), start.y() + l * direction.y(), ctx, &clipped))
+      continue;
+    if (!vertex || start.x() <= ctx.xl || start.x() >= ctx.xh || start.y() <= ctx.yl || start.y() >= ctx.yh)
+      return false;
+    if (std::max(site_distance(edge.cell(), point_type(clipped.x1, clipped.y1), ctx),
+                 site_distance(edge.cell(), point_type(clipped.x2, clipped.y2), ctx)) >= margin)
+      return false;
   }
 
-  for (size_t i = 0; i < segments.size(); i += 4)
-  {
-      lineSites.push_back(Segment(segments[i], segments[i+1], segments[i+2], segments[i+3]));
+  double corners[] = {ctx.xl, ctx.yl, ctx.xh, ctx.yl, ctx.xh, ctx.yh, ctx.xl, ctx.yh};
+  for (int c = 0; c < 8; c += 2) {
+    point_type corner(corners[c], corners[c+1]);
+    double nearest = HUGE_VAL;
+    for (size_t i = 0; i < ctx.pointSites.size(); i++)
+      nearest = std::min(nearest, euclidean_distance(corner, point_type(ctx.pointSites[i].a, ctx.pointSites[i].b)));
+    for (size_t i = 0; i < ctx.lineSites.size(); i++)
+      nearest = std::min(nearest, point_segment_distance(corner, ctx.lineSites[i]));
+    if (nearest >= margin)
+      return false;
   }
+  return true;
+}
 
+/* constructs the diagram of all sites or, if cullSites is set, of the sites that can reach into the bbox. The culled
+   diagram clipped to the bbox is the same as the complete one, outside of it cells are missing */
+static void construct_sites(
+  const std::vector<double>& bbox, const std::vector<int>& points,
+  const std::vector<int>& segments,
+  const std::vector<int>& pointColors,
+  const std::vector<int>& segmentColors,
+  const std::vector<int>& pointTileIdxs,
+  const std::vector<int>& segmentTileIdxs,
+  bool cullSites,
+  SiteSet* sites,
+  voronoi_diagram<double>* vd) {
+  double margin = cullSites ? culling_margin(points, segments, pointTileIdxs, segmentTileIdxs) : HUGE_VAL;
+  for (;;) {
+    bool culled = cull_sites(bbox, points, segments, pointColors, segmentColors, pointTileIdxs, segmentTileIdxs,
+                             margin, sites);
+    vd->clear();
+    construct_voronoi(sites->pointSites.begin(), sites->pointSites.end(),
+                      sites->lineSites.begin(), sites->lineSites.end(),
+                      vd);
+    if (!culled || culling_is_exact(*vd, ClipContext(sites->pointSites, sites->lineSites, bbox, NULL, NULL), margin))
+      break;
+    margin *= 2;
+  }
+}
 
+// builds the diagram and writes it to result or, if flat is set, to flat
+void build_diagram(
+  const std::vector<double>& bbox, const std::vector<int>& points,
+  const std::vector<int>& segments,
+  const std::vector<int>& pointColors,
+  const std::vector<int>& segmentColors,
+  const std::vector<int>& pointTileIdxs,
+  const std::vector<int>& segmentTileIdxs,
+  bool cullSites,
+  DiagrammResult* result,
+  FlatDiagrammResult* flat
+  ) {
   // Construction of the Voronoi Diagram.
+  SiteSet sites;
   voronoi_diagram<double> vd;
-  construct_voronoi(pointSites.begin(), pointSites.end(),
-                    lineSites.begin(), lineSites.end(),
-                    &vd);
+  construct_sites(bbox, points, segments, pointColors, segmentColors, pointTileIdxs, segmentTileIdxs, cullSites, &sites, &vd);
+  const std::vector<SitePoint>& pointSites = sites.pointSites;
+  const std::vector<SiteSegment>& lineSites = sites.lineSites;
 
-  DiagrammResult result;
+  if (flat) {
+    flat->clear();
+  } else {
+    result->cells.reserve(vd.num_cells());
+    result->edges.reserve(vd.num_edges());
+  }
+  ClipContext ctx(pointSites, lineSites, bbox, result, flat);
 
   // --------- CELLS --------------
   // we need to do this part before edges were iterated
@@ -551,39 +856,15 @@ EMSCRIPTEN_KEEPALIVE DiagrammResult compute(
 
     CellResult cellResult;
 
-    cellResult.source_index = cell.source_index();
-    switch(cell.source_category()){
-        case boost::polygon::SOURCE_CATEGORY_SINGLE_POINT:
-          cellResult.source_category = 0;
-          break;
-        case boost::polygon::SOURCE_CATEGORY_SEGMENT_START_POINT:
-          cellResult.source_category = 1;
-          break;
-        case boost::polygon::SOURCE_CATEGORY_SEGMENT_END_POINT:
-          cellResult.source_category = 2;
-          break;
-
-        // Segment subtypes.
-        case boost::polygon::SOURCE_CATEGORY_INITIAL_SEGMENT:
-          cellResult.source_category = 3;
-          break;
-        case boost::polygon::SOURCE_CATEGORY_REVERSE_SEGMENT:
-          cellResult.source_category = 4;
-          break;
-        case boost::polygon::SOURCE_CATEGORY_GEOMETRY_SHIFT:
-          cellResult.source_category = 5;
-          break;
-        case boost::polygon::SOURCE_CATEGORY_BITMASK:
-          cellResult.source_category = 6;
-          break;
-    }
+    cellResult.source_index = sites.sourceIndex[cell.source_index()];
+    cellResult.source_category = source_category(cell);
 
     if(cellResult.source_category == 0){
-      cell.color(pointColors[cell.source_index()]);
-      cellResult.tile_idx = pointTileIdxs[cell.source_index()];
+      cell.color(sites.pointColors[cell.source_index()]);
+      cellResult.tile_idx = cell_tile_idx(&cell, sites.pointTileIdxs, sites.segmentTileIdxs, pointSites.size());
     }else{
-      cell.color(segmentColors[cell.source_index()]);
-      cellResult.tile_idx = segmentTileIdxs[cell.source_index()];
+      cell.color(sites.segmentColors[cell.source_index() - pointSites.size()]);
+      cellResult.tile_idx = cell_tile_idx(&cell, sites.pointTileIdxs, sites.segmentTileIdxs, pointSites.size());
     }
 
     cellResult.is_degenerate = cell.is_degenerate();
@@ -593,7 +874,7 @@ EMSCRIPTEN_KEEPALIVE DiagrammResult compute(
     
     
 
-    result.cells.push_back(cellResult);
+    add_cell(ctx, cellResult);
   }
 
   // --------- EDGES --------------
@@ -621,51 +902,811 @@ EMSCRIPTEN_KEEPALIVE DiagrammResult compute(
     edgeResult.isFinite = edge->is_finite();
     edgeResult.isPrimary = edge->is_primary();
     edgeResult.isCurved = edge->is_curved();
-    edgeResult.isWithinCell = segmentTileIdxs[edge->cell()->source_index()] == segmentTileIdxs[edge->twin()->cell()->source_index()];
+    edgeResult.isWithinCell = cell_tile_idx(edge->cell(), sites.pointTileIdxs, sites.segmentTileIdxs, pointSites.size())
+                           == cell_tile_idx(edge->twin()->cell(), sites.pointTileIdxs, sites.segmentTileIdxs, pointSites.size());
   
     bool added = false;
 
     if(edge->is_finite()){
-      added = clip_add_finite_edge(*edge, &result, &edgeResult, pointSites, lineSites, bbox, i);
+      added = clip_add_finite_edge(*edge, ctx, &edgeResult);
     }else{
-      added = clip_add_infinite_edge(*edge, &result, &edgeResult, pointSites, lineSites, bbox, i);
+      added = clip_add_infinite_edge(*edge, ctx, &edgeResult);
     }
 
     if(added){
       processed.push_back(edge);
+      edge->color(ctx.numEdges); // index + 1 of the result edge, 0 = not added
+    }else{
+      edge->color(0);
     }
     i++;
   }
 
   // --------- VERTICIES --------------
-  result.numVerticies = vd.num_vertices();
+  std::vector<double>& vertices = flat ? flat->vertices : result->vertices;
+  if (!flat) {
+    result->numVerticies = vd.num_vertices();
+  }
   i = 0;
   for (voronoi_diagram<double>::const_vertex_iterator it = vd.vertices().begin(); it != vd.vertices().end(); ++it) {
     const voronoi_diagram<double>::vertex_type& vertex = *it;
-    result.vertices.push_back(vertex.x());
-    result.vertices.push_back(vertex.y());
+    vertices.push_back(vertex.x());
+    vertices.push_back(vertex.y());
   }
 
 
   // -------- CELLS 2 ---------------
   // we need to do this part after edges were iterated
-  for (int j = 0; j < vd.cells().size(); ++j) {
+  for (int j = 0; j < (int)vd.cells().size(); ++j) {
     const voronoi_diagram<double>::cell_type& cell = vd.cells()[j];
 
+    // the edge color holds the index of the result edge (set while the edges were added)
     const voronoi_diagram<double>::edge_type* edge = cell.incident_edge();
       do {
-        for (int i = 0; i < result.edges.size(); i++){
-          if(result.edges[i].edge_ref == edge){
-            result.cells[j].edge_indices.push_back(i);
-          }
+        if(edge->color() != 0){
+          if (flat)
+            flat->cellEdgeIndices.push_back(edge->color() - 1);
+          else
+            result->cells[j].edge_indices.push_back(edge->color() - 1);
+        }
+        edge = edge->next();
+      } while (edge != cell.incident_edge());
+      if (flat)
+        flat->cellEdgeOffsets.push_back(flat->cellEdgeIndices.size());
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//--------------------------tile outlines-----------------------------------------------------------
+//--------------------------------------------------------------------------------------------------
+/* The boundaries between cells of different tiles chained to polylines, without the edges inside of the tiles.
+   Every boundary half-edge is taken on the side of its own cell: the outline of a tile runs around it once in the
+   direction of the cell edges and the twin half-edges are part of the outline of the neighbouring tile. */
+
+struct Polyline {
+  std::vector<double> points;            // x, y
+  std::vector<unsigned char> flags;      // OUTLINE_* per point
+};
+
+struct OutlineContext {
+  const cell_type* cells;                // first cell of the diagram
+  std::vector<int> cellTiles;            // tile index per cell
+};
+
+static int edge_tile(const edge_type* edge, const OutlineContext& octx) {
+  return octx.cellTiles[edge->cell() - octx.cells];
+}
+
+static bool is_outline(const edge_type* edge, const OutlineContext& octx) {
+  return edge_tile(edge, octx) != edge_tile(edge->twin(), octx);
+}
+
+// the outline half-edge of the same tile that starts where edge ends
+static const edge_type* next_outline(const edge_type* edge, const OutlineContext& octx) {
+  const edge_type* next = edge->next();
+  while (!is_outline(next, octx))
+    next = next->twin()->next(); // the same vertex in the neighbouring cell
+  return next;
+}
+
+// the outline half-edge of the same tile that ends where edge starts
+static const edge_type* prev_outline(const edge_type* edge, const OutlineContext& octx) {
+  const edge_type* prev = edge->prev();
+  while (!is_outline(prev, octx))
+    prev = prev->twin()->prev();
+  return prev;
+}
+
+// clips the half-edge to the bbox, infinite edges end a bbox diagonal behind the bbox
+static bool clip_half_edge(const edge_type* edge, const ClipContext& ctx, EdgeResult* clipped) {
+  if (edge->is_finite())
+    return clip_line(edge->vertex0()->x(), edge->vertex0()->y(), edge->vertex1()->x(), edge->vertex1()->y(), ctx, clipped);
+
+  point_type origin, direction;
+  const voronoi_diagram<double>::vertex_type* vertex = edge->vertex0() ? edge->vertex0() : edge->vertex1();
+  if (!vertex || !infinite_edge_ray(*edge, ctx, &origin, &direction))
+    return false;
+  double l = fabs(vertex->x() - ctx.xl) + fabs(vertex->y() - ctx.yl) + (ctx.xh - ctx.xl) + (ctx.yh - ctx.yl);
+  double fx = vertex->x() + l * direction.x(), fy = vertex->y() + l * direction.y();
+  if (edge->vertex0())
+    return clip_line(vertex->x(), vertex->y(), fx, fy, ctx, clipped);
+  return clip_line(fx, fy, vertex->x(), vertex->y(), ctx, clipped);
+}
+
+/* appends the chain of outline half-edges as polylines, the chain is split where it leaves the bbox.
+   A closed chain that is completely inside of the bbox gives one closed polyline. */
+static void add_outline(
+  const std::vector<const edge_type*>& chain,
+  bool closed,
+  int tile,
+  int color,
+  ClipContext& ctx,
+  OutlineResult* result) {
+  std::vector<Polyline> polylines;
+  bool startsWithChain = false; // the first polyline starts with the unclipped first edge
+  bool open = false;            // the last polyline ends with an unclipped vertex and can be continued
+  for (size_t i = 0; i < chain.size(); i++) {
+    const edge_type* edge = chain[i];
+    EdgeResult clipped;
+    if (!clip_half_edge(edge, ctx, &clipped)) {
+      open = false;
+      continue;
+    }
+    bool startUnclipped = edge->vertex0() && clipped.x1 == edge->vertex0()->x() && clipped.y1 == edge->vertex0()->y();
+    if (!open || !startUnclipped) {
+      if (i == 0)
+        startsWithChain = startUnclipped;
+      polylines.push_back(Polyline());
+      polylines.back().points.push_back(clipped.x1);
+      polylines.back().points.push_back(clipped.y1);
+      polylines.back().flags.push_back(0);
+    }
+    Polyline& polyline = polylines.back();
+
+    if (edge->is_curved()) {
+      ctx.controll_points.clear();
+      ctx.controll_points.push_back(point_type(clipped.x1, clipped.y1));
+      ctx.controll_points.push_back(point_type(clipped.x2, clipped.y2));
+      SitePoint point = edge->cell()->contains_point() ?
+        retrieve_point(edge->cell(), ctx.pointSites, ctx.lineSites) :
+        retrieve_point(edge->twin()->cell(), ctx.pointSites, ctx.lineSites);
+      SiteSegment segment = edge->cell()->contains_point() ?
+        retrieve_segment(edge->twin()->cell(), ctx.pointSites, ctx.lineSites) :
+        retrieve_segment(edge->cell(), ctx.pointSites, ctx.lineSites);
+      calc_control_points(point, segment, &ctx.controll_points);
+      if (ctx.controll_points.size() == 3) {
+        polyline.points.push_back(ctx.controll_points[1].x());
+        polyline.points.push_back(ctx.controll_points[1].y());
+        polyline.flags.push_back(OUTLINE_CONTROL_POINT);
+      }
+    }
+    polyline.points.push_back(clipped.x2);
+    polyline.points.push_back(clipped.y2);
+    polyline.flags.push_back(0);
+    open = edge->vertex1() && clipped.x2 == edge->vertex1()->x() && clipped.y2 == edge->vertex1()->y();
+  }
+  if (polylines.empty())
+    return;
+
+  bool closedPolyline = false;
+  if (closed && open && startsWithChain) {
+    if (polylines.size() == 1) {
+      // the last point is the first one
+      closedPolyline = true;
+      polylines[0].points.resize(polylines[0].points.size() - 2);
+      polylines[0].flags.pop_back();
+    } else {
+      // the last polyline continues with the first one
+      Polyline& first = polylines.front();
+      Polyline& last = polylines.back();
+      last.points.insert(last.points.end(), first.points.begin() + 2, first.points.end());
+      last.flags.insert(last.flags.end(), first.flags.begin() + 1, first.flags.end());
+      polylines.erase(polylines.begin());
+    }
+  }
+
+  for (size_t i = 0; i < polylines.size(); i++) {
+    result->points.insert(result->points.end(), polylines[i].points.begin(), polylines[i].points.end());
+    result->pointFlags.insert(result->pointFlags.end(), polylines[i].flags.begin(), polylines[i].flags.end());
+    result->pointOffsets.push_back(result->pointFlags.size());
+    result->tileIdxs.push_back(tile);
+    result->colors.push_back(color);
+    result->closed.push_back(closedPolyline);
+  }
+}
+
+/* builds the outlines of the tiles (tileIdx < 0) or of the tile with index tileIdx, the arguments are the same as
+   for build_diagram */
+void build_outlines(
+  const std::vector<double>& bbox, const std::vector<int>& points,
+  const std::vector<int>& segments,
+  const std::vector<int>& pointColors,
+  const std::vector<int>& segmentColors,
+  const std::vector<int>& pointTileIdxs,
+  const std::vector<int>& segmentTileIdxs,
+  bool cullSites,
+  int tileIdx,
+  OutlineResult* result
+  ) {
+  result->clear();
+  SiteSet sites;
+  voronoi_diagram<double> vd;
+  construct_sites(bbox, points, segments, pointColors, segmentColors, pointTileIdxs, segmentTileIdxs, cullSites, &sites, &vd);
+  if (vd.num_cells() == 0)
+    return;
+
+  OutlineContext octx;
+  octx.cells = &vd.cells()[0];
+  for (voronoi_diagram<double>::const_cell_iterator it = vd.cells().begin(); it != vd.cells().end(); ++it)
+    octx.cellTiles.push_back(cell_tile_idx(&*it, sites.pointTileIdxs, sites.segmentTileIdxs, sites.pointSites.size()));
+
+  ClipContext ctx(sites.pointSites, sites.lineSites, bbox, NULL, NULL);
+  for (voronoi_diagram<double>::const_edge_iterator it = vd.edges().begin(); it != vd.edges().end(); ++it)
+    it->color(0);
+  std::vector<const edge_type*> chain;
+  for (voronoi_diagram<double>::const_edge_iterator it = vd.edges().begin(); it != vd.edges().end(); ++it) {
+    const edge_type* start = &*it;
+    if (start->color() || !is_outline(start, octx))
+      continue;
+    int tile = edge_tile(start, octx);
+    if (tileIdx >= 0 && tile != tileIdx)
+      continue;
+
+    // forward until the chain is closed or runs into infinity, then backward from the start
+    chain.clear();
+    bool closed = false;
+    const edge_type* edge = start;
+    do {
+      chain.push_back(edge);
+      edge->color(1);
+      if (!edge->vertex1())
+        break;
+      edge = next_outline(edge, octx);
+      closed = edge == start;
+    } while (!closed && !edge->color());
+    if (!closed) {
+      std::vector<const edge_type*> backward;
+      edge = start;
+      while (edge->vertex0()) {
+        edge = prev_outline(edge, octx);
+        if (edge->color())
+          break;
+        edge->color(1);
+        backward.push_back(edge);
+      }
+      chain.insert(chain.begin(), backward.rbegin(), backward.rend());
+    }
+
+    int color = start->cell()->source_category() == boost::polygon::SOURCE_CATEGORY_SINGLE_POINT ?
+      sites.pointColors[start->cell()->source_index()] :
+      sites.segmentColors[start->cell()->source_index() - sites.pointSites.size()];
+    add_outline(chain, closed, tile, color, ctx, result);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//--------------------------tiled diagram-----------------------------------------------------------
+//--------------------------------------------------------------------------------------------------
+/* The sites of a tiling are copies of the sites of one tile under the tile transforms (similarities).
+   The cells of a tile only depend on the sites nearby, so the diagram is built for one fundamental tile and a ring of
+   neighbours around it, and the cells of the fundamental tile are transformed to every other tile. The ring grows
+   until no site outside of it can change the fundamental cells. */
+
+// 2d affine transform in the layout of transformation-matrix: x' = a x + c y + e, y' = b x + d y + f
+struct Affine {
+  double a, b, c, d, e, f;
+
+  Affine() : a(1), b(0), c(0), d(1), e(0), f(0) {}
+  Affine(const double* m) : a(m[0]), b(m[1]), c(m[2]), d(m[3]), e(m[4]), f(m[5]) {}
+
+  point_type apply(double px, double py) const {
+    return point_type(a * px + c * py + e, b * px + d * py + f);
+  }
+  point_type apply(const point_type& p) const {
+    return apply(p.x(), p.y());
+  }
+
+  // this after other
+  Affine operator*(const Affine& o) const {
+    Affine r;
+    r.a = a * o.a + c * o.b;
+    r.b = b * o.a + d * o.b;
+    r.c = a * o.c + c * o.d;
+    r.d = b * o.c + d * o.d;
+    r.e = a * o.e + c * o.f + e;
+    r.f = b * o.e + d * o.f + f;
+    return r;
+  }
+
+  Affine inverse() const {
+    double det = a * d - b * c;
+    Affine r;
+    r.a = d / det;
+    r.b = -b / det;
+    r.c = -c / det;
+    r.d = a / det;
+    r.e = -(r.a * e + r.c * f);
+    r.f = -(r.b * e + r.d * f);
+    return r;
+  }
+
+  double scale() const {
+    return sqrt(fabs(a * d - b * c));
+  }
+};
+
+// an edge of a fundamental cell in the coordinates of the fundamental tile
+struct TiledEdge {
+  point_type v0, v1;
+  point_type control_points[3]; // quadratic bezier if curved
+  bool isCurved;
+  bool isPrimary;
+  bool isWithinCell;
+};
+
+// a cell of the fundamental tile, its edges are edges[firstEdge, firstEdge + numEdges)
+struct TiledCell {
+  bool isSegment;   // site is template segment siteIdx, else template point siteIdx
+  int siteIdx;
+  int source_category;
+  bool is_degenerate;
+  bool contains_point;
+  bool contains_segment;
+  int firstEdge;
+  int numEdges;
+};
+
+// position of p on the line a - b, 0 at a and 1 at b
+static double line_parameter(const point_type& p, const point_type& a, const point_type& b) {
+  double dx = b.x() - a.x(), dy = b.y() - a.y();
+  double l2 = dx * dx + dy * dy;
+  return l2 > 0 ? ((p.x() - a.x()) * dx + (p.y() - a.y()) * dy) / l2 : 0;
+}
+
+// blossom of the quadratic bezier c, (u, u) is the point at u, (u, v) the middle control point of the part [u, v]
+static point_type bezier_blossom(const point_type* c, double u, double v) {
+  double w0 = (1 - u) * (1 - v), w1 = (1 - u) * v + u * (1 - v), w2 = u * v;
+  return point_type(w0 * c[0].x() + w1 * c[1].x() + w2 * c[2].x(), w0 * c[0].y() + w1 * c[1].y() + w2 * c[2].y());
+}
+
+// the sites of the given tiles in canvas coordinates, rounded to the integer grid of the voronoi builder
+static void tile_sites(
+  const std::vector<int>& tiles,
+  const std::vector<Affine>& transforms,
+  const std::vector<double>& points,
+  const std::vector<double>& segments,
+  std::vector<SitePoint>& pointSites,
+  std::vector<SiteSegment>& lineSites) {
+  pointSites.clear();
+  lineSites.clear();
+  for (size_t k = 0; k < tiles.size(); k++) {
+    const Affine& T = transforms[tiles[k]];
+    for (size_t i = 0; i < points.size(); i += 2) {
+      point_type p = T.apply(points[i], points[i+1]);
+      pointSites.push_back(SitePoint((int)round(p.x()), (int)round(p.y())));
+    }
+    for (size_t i = 0; i < segments.size(); i += 4) {
+      point_type p0 = T.apply(segments[i], segments[i+1]);
+      point_type p1 = T.apply(segments[i+2], segments[i+3]);
+      lineSites.push_back(SiteSegment((int)round(p0.x()), (int)round(p0.y()), (int)round(p1.x()), (int)round(p1.y())));
+    }
+  }
+}
+
+/* true if no site of the tiles outside of the ring (byDistance[ringSize..]) can own a point of the cell. The distance
+   to the own site is largest in the ends of an edge (see culling_is_exact), so an edge holds if the bounding circle
+   of every outer tile is further than that from the bbox of the edge. The cell is star-shaped around its site: a
+   point inside that is closer to another site makes the boundary point behind it closer as well */
+static bool ring_cell_is_exact(
+  const cell_type& cell,
+  const ClipContext& ctx,
+  const std::vector<std::pair<double, int> >& byDistance,
+  size_t ringSize,
+  const std::vector<point_type>& centers,
+  const std::vector<double>& radii) {
+  const edge_type* edge = cell.incident_edge();
+  do {
+    if (edge->is_infinite())
+      return false;
+    double r = std::max(site_distance(&cell, point_type(edge->vertex0()->x(), edge->vertex0()->y()), ctx),
+                        site_distance(&cell, point_type(edge->vertex1()->x(), edge->vertex1()->y()), ctx));
+    std::vector<double> bounds = edge_bounds(*edge, ctx);
+    for (size_t i = ringSize; i < byDistance.size(); i++) {
+      const point_type& c = centers[byDistance[i].second];
+      if (bbox_distance(bounds, c.x(), c.y(), c.x(), c.y()) - radii[byDistance[i].second] <= r + 1)
+        return false;
+    }
+    edge = edge->next();
+  } while (edge != cell.incident_edge());
+  return true;
+}
+
+/* builds the diagram of a tiling: points and segments are the sites of one tile (x, y / x1, y1, x2, y2),
+   tileTransforms the 6 affine coefficients per tile (a, b, c, d, e, f) and fundamentalTile the tile the cells are
+   computed for (-1: the tile closest to the bbox center).
+   The output has the layout of build_diagram, the sites are numbered as if all tiles were passed:
+   points of tile k: k * numPoints + i, segments: numTiles * numPoints + k * numSegments + i */
+void build_tiled_diagram(
+  const std::vector<double>& bbox,
+  const std::vector<double>& points,
+  const std::vector<double>& segments,
+  const std::vector<double>& tileTransforms,
+  const std::vector<int>& tileColors,
+  const std::vector<int>& tileIdxs,
+  int fundamentalTile,
+  DiagrammResult* result,
+  FlatDiagrammResult* flat
+  ) {
+  int numTiles = tileTransforms.size() / 6;
+  int numPoints = points.size() / 2;
+  int numSegments = segments.size() / 4;
+  if (bbox.size() != 4 || points.size() % 2 || segments.size() % 4 || tileTransforms.size() % 6 ||
+      (int)tileColors.size() != numTiles || (int)tileIdxs.size() != numTiles)
+    throw std::runtime_error("build_tiled_diagram: inconsistent input sizes");
+
+  if (flat)
+    flat->clear();
+  else
+    result->numVerticies = 0;
+  if (numTiles == 0 || numPoints + numSegments == 0)
+    return;
+
+  std::vector<Affine> transforms;
+  for (int k = 0; k < numTiles; k++)
+    transforms.push_back(Affine(&tileTransforms[6 * k]));
+
+  // bounding circle of the template sites, per tile
+  double cx = 0, cy = 0;
+  std::vector<point_type> templatePoints;
+  for (int i = 0; i < numPoints; i++)
+    templatePoints.push_back(point_type(points[2 * i], points[2 * i + 1]));
+  for (int i = 0; i < 2 * numSegments; i++)
+    templatePoints.push_back(point_type(segments[2 * i], segments[2 * i + 1]));
+  for (size_t i = 0; i < templatePoints.size(); i++) {
+    cx += templatePoints[i].x() / templatePoints.size();
+    cy += templatePoints[i].y() / templatePoints.size();
+  }
+  double templateRadius = 0;
+  for (size_t i = 0; i < templatePoints.size(); i++)
+    templateRadius = std::max(templateRadius, euclidean_distance(templatePoints[i], point_type(cx, cy)));
+
+  std::vector<point_type> centers;
+  std::vector<double> radii;
+  for (int k = 0; k < numTiles; k++) {
+    centers.push_back(transforms[k].apply(cx, cy));
+    radii.push_back(templateRadius * transforms[k].scale() + 1); // + rounding to the integer grid
+  }
+
+  int f = fundamentalTile;
+  if (f < 0 || f >= numTiles) {
+    point_type bboxCenter((bbox[0] + bbox[2]) / 2, (bbox[1] + bbox[3]) / 2);
+    f = 0;
+    for (int k = 1; k < numTiles; k++) {
+      if (euclidean_distance(centers[k], bboxCenter) < euclidean_distance(centers[f], bboxCenter))
+        f = k;
+    }
+  }
+
+  // other tiles by distance to the fundamental tile
+  std::vector<std::pair<double, int> > byDistance;
+  for (int k = 0; k < numTiles; k++) {
+    if (k != f)
+      byDistance.push_back(std::make_pair(euclidean_distance(centers[k], centers[f]), k));
+  }
+  std::sort(byDistance.begin(), byDistance.end());
+
+  std::vector<SitePoint> pointSites;
+  std::vector<SiteSegment> lineSites;
+  voronoi_diagram<double> vd;
+  double ringRadius = byDistance.empty() ? 0 : std::max(byDistance[0].first, 2 * radii[f]) * 1.5;
+  size_t ringSize = 0;
+  bool valid = false;
+  while (!valid) {
+    while (ringSize < byDistance.size() && byDistance[ringSize].first <= ringRadius)
+      ringSize++;
+    if (ringSize == byDistance.size())
+      break; // every tile is in the ring, build the whole diagram instead
+
+    std::vector<int> ring(1, f);
+    for (size_t i = 0; i < ringSize; i++)
+      ring.push_back(byDistance[i].second);
+    tile_sites(ring, transforms, points, segments, pointSites, lineSites);
+    vd.clear();
+    construct_voronoi(pointSites.begin(), pointSites.end(), lineSites.begin(), lineSites.end(), &vd);
+
+    // every point of a fundamental cell has to be closer to its site than to any tile outside of the ring
+    ClipContext ringCtx(pointSites, lineSites, bbox, NULL, NULL);
+    valid = true;
+    for (voronoi_diagram<double>::const_cell_iterator it = vd.cells().begin(); valid && it != vd.cells().end(); ++it) {
+      const cell_type& cell = *it;
+      bool isSegment = cell.source_category() != boost::polygon::SOURCE_CATEGORY_SINGLE_POINT;
+      size_t siteIdx = isSegment ? cell.source_index() - pointSites.size() : cell.source_index();
+      if (siteIdx >= (size_t)(isSegment ? numSegments : numPoints) || cell.incident_edge() == NULL)
+        continue;
+      valid = ring_cell_is_exact(cell, ringCtx, byDistance, ringSize, centers, radii);
+    }
+    ringRadius *= 1.5;
+  }
+
+  if (!valid) {
+    // no ring smaller than the tiling, build the diagram of all sites
+    std::vector<int> all;
+    for (int k = 0; k < numTiles; k++)
+      all.push_back(k);
+    tile_sites(all, transforms, points, segments, pointSites, lineSites);
+    std::vector<int> pointsInt, segmentsInt, pointColors, segmentColors, pointTileIdxs, segmentTileIdxs;
+    for (size_t i = 0; i < pointSites.size(); i++) {
+      pointsInt.push_back(pointSites[i].a);
+      pointsInt.push_back(pointSites[i].b);
+      pointColors.push_back(tileColors[i / numPoints]);
+      pointTileIdxs.push_back(tileIdxs[i / numPoints]);
+    }
+    for (size_t i = 0; i < lineSites.size(); i++) {
+      int s[] = {lineSites[i].p0.a, lineSites[i].p0.b, lineSites[i].p1.a, lineSites[i].p1.b};
+      segmentsInt.insert(segmentsInt.end(), s, s + 4);
+      segmentColors.push_back(tileColors[i / numSegments]);
+      segmentTileIdxs.push_back(tileIdxs[i / numSegments]);
+    }
+    build_diagram(bbox, pointsInt, segmentsInt, pointColors, segmentColors, pointTileIdxs, segmentTileIdxs, true, result, flat);
+    return;
+  }
+
+  // --------- FUNDAMENTAL CELLS --------------
+  // the fundamental tile comes first in the ring, its sites have the lowest indices
+  std::vector<TiledCell> cells;
+  std::vector<TiledEdge> edges;
+  std::vector<point_type> vertices;
+  std::vector<point_type> controll_points;
+  for (voronoi_diagram<double>::const_vertex_iterator it = vd.vertices().begin(); it != vd.vertices().end(); ++it)
+    it->color(0);
+  for (voronoi_diagram<double>::const_cell_iterator it = vd.cells().begin(); it != vd.cells().end(); ++it) {
+    const cell_type& cell = *it;
+    TiledCell tiledCell;
+    tiledCell.isSegment = cell.source_category() != boost::polygon::SOURCE_CATEGORY_SINGLE_POINT;
+    tiledCell.siteIdx = tiledCell.isSegment ? cell.source_index() - pointSites.size() : cell.source_index();
+    if (tiledCell.siteIdx >= (tiledCell.isSegment ? numSegments : numPoints))
+      continue;
+    tiledCell.source_category = source_category(cell);
+    tiledCell.is_degenerate = cell.is_degenerate();
+    tiledCell.contains_point = cell.contains_point();
+    tiledCell.contains_segment = cell.contains_segment();
+    tiledCell.firstEdge = edges.size();
+
+    const edge_type* edge = cell.incident_edge();
+    if (edge) {
+      do {
+        TiledEdge tiledEdge;
+        tiledEdge.v0 = point_type(edge->vertex0()->x(), edge->vertex0()->y());
+        tiledEdge.v1 = point_type(edge->vertex1()->x(), edge->vertex1()->y());
+        tiledEdge.isCurved = edge->is_curved();
+        tiledEdge.isPrimary = edge->is_primary();
+        const cell_type* twin = edge->twin()->cell();
+        bool twinIsSegment = twin->source_category() != boost::polygon::SOURCE_CATEGORY_SINGLE_POINT;
+        size_t twinSiteIdx = twinIsSegment ? twin->source_index() - pointSites.size() : twin->source_index();
+        tiledEdge.isWithinCell = twinSiteIdx < (size_t)(twinIsSegment ? numSegments : numPoints);
+        if (tiledEdge.isCurved) {
+          controll_points.clear();
+          controll_points.push_back(tiledEdge.v0);
+          controll_points.push_back(tiledEdge.v1);
+          SitePoint point = edge->cell()->contains_point() ?
+            retrieve_point(edge->cell(), pointSites, lineSites) :
+            retrieve_point(edge->twin()->cell(), pointSites, lineSites);
+          SiteSegment segment = edge->cell()->contains_point() ?
+            retrieve_segment(edge->twin()->cell(), pointSites, lineSites) :
+            retrieve_segment(edge->cell(), pointSites, lineSites);
+          calc_control_points(point, segment, &controll_points);
+          for (int i = 0; i < 3; i++)
+            tiledEdge.control_points[i] = controll_points[i];
+        }
+        edges.push_back(tiledEdge);
+
+        if (edge->vertex0()->color() == 0) {
+          edge->vertex0()->color(1);
+          vertices.push_back(tiledEdge.v0);
         }
         edge = edge->next();
       } while (edge != cell.incident_edge());
+    }
+    tiledCell.numEdges = edges.size() - tiledCell.firstEdge;
+    cells.push_back(tiledCell);
+  }
+
+  // --------- COPIES --------------
+  ClipContext ctx(pointSites, lineSites, bbox, result, flat);
+  Affine toFundamental = transforms[f].inverse();
+  std::vector<double>& vertexOutput = flat ? flat->vertices : result->vertices;
+  if (!flat) {
+    result->cells.reserve(cells.size() * numTiles);
+    result->edges.reserve(edges.size() * numTiles);
+  }
+  for (int k = 0; k < numTiles; k++) {
+    Affine Q = transforms[k] * toFundamental;
+
+    for (size_t i = 0; i < vertices.size(); i++) {
+      point_type v = Q.apply(vertices[i]);
+      vertexOutput.push_back(v.x());
+      vertexOutput.push_back(v.y());
+    }
+
+    for (size_t j = 0; j < cells.size(); j++) {
+      const TiledCell& tiledCell = cells[j];
+      CellResult cellResult;
+      cellResult.source_index = tiledCell.isSegment ?
+        numTiles * numPoints + k * numSegments + tiledCell.siteIdx :
+        k * numPoints + tiledCell.siteIdx;
+      cellResult.source_category = tiledCell.source_category;
+      if (tiledCell.source_category == 3 || tiledCell.source_category == 4) {
+        // boost orders the ends of a segment site by x, y, in a turned copy they can be the other way round
+        const double* segment = &segments[4 * tiledCell.siteIdx];
+        point_type p0 = transforms[k].apply(segment[0], segment[1]);
+        point_type p1 = transforms[k].apply(segment[2], segment[3]);
+        double x0 = round(p0.x()), y0 = round(p0.y()), x1 = round(p1.x()), y1 = round(p1.y());
+        cellResult.source_category = (x0 == x1 ? y0 < y1 : x0 < x1) ? 3 : 4;
+      }
+      cellResult.is_degenerate = tiledCell.is_degenerate;
+      cellResult.contains_point = tiledCell.contains_point;
+      cellResult.contains_segment = tiledCell.contains_segment;
+      cellResult.color = tileColors[k];
+      cellResult.tile_idx = tileIdxs[k];
+
+      int firstEdge = ctx.numEdges;
+      for (int e = tiledCell.firstEdge; e < tiledCell.firstEdge + tiledCell.numEdges; e++) {
+        const TiledEdge& tiledEdge = edges[e];
+        point_type v0 = Q.apply(tiledEdge.v0);
+        point_type v1 = Q.apply(tiledEdge.v1);
+
+        EdgeResult edgeResult;
+        edgeResult.edge_ref = NULL;
+        edgeResult.isFinite = true;
+        edgeResult.isCurved = tiledEdge.isCurved;
+        edgeResult.isPrimary = tiledEdge.isPrimary;
+        edgeResult.isWithinCell = tiledEdge.isWithinCell;
+        if (!clip_line(v0.x(), v0.y(), v1.x(), v1.y(), ctx, &edgeResult))
+          continue;
+
+        ctx.controll_points.clear();
+        if (tiledEdge.isCurved) {
+          // same as clip_add_finite_edge: the clipped ends with the control point of the parabola between them
+          point_type c[3];
+          for (int i = 0; i < 3; i++)
+            c[i] = Q.apply(tiledEdge.control_points[i]);
+          point_type p1(edgeResult.x1, edgeResult.y1);
+          point_type p2(edgeResult.x2, edgeResult.y2);
+          ctx.controll_points.push_back(p1);
+          ctx.controll_points.push_back(bezier_blossom(c, line_parameter(p1, v0, v1), line_parameter(p2, v0, v1)));
+          ctx.controll_points.push_back(p2);
+        }
+        add_edge(ctx, &edgeResult);
+        if (flat)
+          flat->cellEdgeIndices.push_back(ctx.numEdges - 1);
+        else
+          cellResult.edge_indices.push_back(ctx.numEdges - 1);
+      }
+
+      // cells outside of the bbox are left out, most copies of a large tiling have no edge in it
+      if (ctx.numEdges == firstEdge)
+        continue;
+      add_cell(ctx, cellResult);
+      if (flat)
+        flat->cellEdgeOffsets.push_back(flat->cellEdgeIndices.size());
+    }
   }
+  if (!flat)
+    result->numVerticies = vertexOutput.size() / 2;
+}
+
+EMSCRIPTEN_KEEPALIVE DiagrammResult computeTiled(
+  std::vector<double> bbox,
+  std::vector<double> points,
+  std::vector<double> segments,
+  std::vector<double> tileTransforms,
+  std::vector<int> tileColors,
+  std::vector<int> tileIdxs,
+  int fundamentalTile
+  ) {
+  DiagrammResult result;
+  build_tiled_diagram(bbox, points, segments, tileTransforms, tileColors, tileIdxs, fundamentalTile, &result, NULL);
+  return result;
+}
 
+EMSCRIPTEN_KEEPALIVE DiagrammResult compute(
+  std::vector<double> bbox, std::vector<int> points, 
+  std::vector<int> segments, 
+  std::vector<int> pointColors, 
+  std::vector<int> segmentColors,
+  std::vector<int> pointTileIdxs,
+  std::vector<int> segmentTileIdxs
+  ) {
+  DiagrammResult result;
+  build_diagram(bbox, points, segments, pointColors, segmentColors, pointTileIdxs, segmentTileIdxs, false, &result, NULL);
+  return result;
+}
+
+/* Same as compute but leaves out the sites that cannot reach into the bbox. Within the bbox the diagram is the same,
+   cells and edges outside of it are missing */
+EMSCRIPTEN_KEEPALIVE DiagrammResult computeCulled(
+  std::vector<double> bbox, std::vector<int> points,
+  std::vector<int> segments,
+  std::vector<int> pointColors,
+  std::vector<int> segmentColors,
+  std::vector<int> pointTileIdxs,
+  std::vector<int> segmentTileIdxs
+  ) {
+  DiagrammResult result;
+  build_diagram(bbox, points, segments, pointColors, segmentColors, pointTileIdxs, segmentTileIdxs, true, &result, NULL);
+  return result;
+}
+
+#ifdef __EMSCRIPTEN__
+/* kept between calls, the views returned by computeFlat point into it. Like outlineResult it is a global without a
+   lock, the embind entry points have one caller at a time (the javascript thread of the module). Native callers
+   pass their own results to build_diagram / build_outlines */
+FlatDiagrammResult flatResult;
+
+template <typename T>
+val view(const std::vector<T>& v) {
+  return val(typed_memory_view(v.size(), v.data()));
+}
+
+// typed array views of flatResult
+val flatView() {
+  val result = val::object();
+  result.set("numVertices", (int)flatResult.vertices.size() / 2);
+  result.set("numEdges", (int)flatResult.edgeFlags.size());
+  result.set("numCells", (int)flatResult.cellFlags.size());
+  result.set("vertices", view(flatResult.vertices));
+  result.set("edgeCoords", view(flatResult.edgeCoords));
+  result.set("edgeFlags", view(flatResult.edgeFlags));
+  result.set("controlPoints", view(flatResult.controlPoints));
+  result.set("controlPointOffsets", view(flatResult.controlPointOffsets));
+  result.set("cellSourceIndices", view(flatResult.cellSourceIndices));
+  result.set("cellSourceCategories", view(flatResult.cellSourceCategories));
+  result.set("cellFlags", view(flatResult.cellFlags));
+  result.set("cellColors", view(flatResult.cellColors));
+  result.set("cellTileIdxs", view(flatResult.cellTileIdxs));
+  result.set("cellEdgeOffsets", view(flatResult.cellEdgeOffsets));
+  result.set("cellEdgeIndices", view(flatResult.cellEdgeIndices));
+  return result;
+}
+
+/* Same diagram as compute (computeCulled if cullSites is set), returned as typed array views into the wasm memory
+   instead of embind objects. The views are only valid until the next call (or memory growth) */
+EMSCRIPTEN_KEEPALIVE val computeFlat(
+  std::vector<double> bbox, std::vector<int> points,
+  std::vector<int> segments,
+  std::vector<int> pointColors,
+  std::vector<int> segmentColors,
+  std::vector<int> pointTileIdxs,
+  std::vector<int> segmentTileIdxs,
+  bool cullSites
+  ) {
+  build_diagram(bbox, points, segments, pointColors, segmentColors, pointTileIdxs, segmentTileIdxs, cullSites, NULL, &flatResult);
+  return flatView();
+}
+
+// kept between calls like flatResult
+OutlineResult outlineResult;
+
+/* Outlines of the tiles (tileIdx < 0) or of one tile, returned as typed array views like computeFlat.
+   Polyline j has the points [pointOffsets[j], pointOffsets[j+1]) */
+EMSCRIPTEN_KEEPALIVE val computeOutlines(
+  std::vector<double> bbox, std::vector<int> points,
+  std::vector<int> segments,
+  std::vector<int> pointColors,
+  std::vector<int> segmentColors,
+  std::vector<int> pointTileIdxs,
+  std::vector<int> segmentTileIdxs,
+  bool cullSites,
+  int tileIdx
+  ) {
+  build_outlines(bbox, points, segments, pointColors, segmentColors, pointTileIdxs, segmentTileIdxs, cullSites, tileIdx, &outlineResult);
+
+  val result = val::object();
+  result.set("numPolylines", (int)outlineResult.closed.size());
+  result.set("points", view(outlineResult.points));
+  result.set("pointFlags", view(outlineResult.pointFlags));
+  result.set("pointOffsets", view(outlineResult.pointOffsets));
+  result.set("tileIdxs", view(outlineResult.tileIdxs));
+  result.set("colors", view(outlineResult.colors));
+  result.set("closed", view(outlineResult.closed));
   return result;
 }
 
+/* Same diagram as computeTiled, returned like computeFlat */
+EMSCRIPTEN_KEEPALIVE val computeTiledFlat(
+  std::vector<double> bbox,
+  std::vector<double> points,
+  std::vector<double> segments,
+  std::vector<double> tileTransforms,
+  std::vector<int> tileColors,
+  std::vector<int> tileIdxs,
+  int fundamentalTile
+  ) {
+  build_tiled_diagram(bbox, points, segments, tileTransforms, tileColors, tileIdxs, fundamentalTile, NULL, &flatResult);
+  return flatView();
+}
+
+
 
 // // Binding code
 EMSCRIPTEN_BINDINGS(myvoronoi) {
@@ -705,5 +1746,20 @@ EMSCRIPTEN_BINDINGS(myvoronoi) {
     ;
 
   emscripten::function("computevoronoi", &compute);
+  emscripten::function("computevoronoiculled", &computeCulled);
+  emscripten::function("computevoronoiflat", &computeFlat);
+  emscripten::function("computevoronoioutlines", &computeOutlines);
+  emscripten::function("computevoronoitiled", &computeTiled);
+  emscripten::function("computevoronoitiledflat", &computeTiledFlat);
+
+  constant("EDGE_FINITE", EDGE_FINITE);
+  constant("EDGE_CURVED", EDGE_CURVED);
+  constant("EDGE_PRIMARY", EDGE_PRIMARY);
+  constant("EDGE_WITHIN_CELL", EDGE_WITHIN_CELL);
+  constant("CELL_DEGENERATE", CELL_DEGENERATE);
+  constant("CELL_CONTAINS_POINT", CELL_CONTAINS_POINT);
+  constant("CELL_CONTAINS_SEGMENT", CELL_CONTAINS_SEGMENT);
+  constant("OUTLINE_CONTROL_POINT", OUTLINE_CONTROL_POINT);
 
 }
+#endif
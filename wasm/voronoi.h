@@ -0,0 +1,167 @@
+#ifndef _H_VORONOI
+#define _H_VORONOI
+
+#include <vector>
+#include <boost/polygon/voronoi.hpp>
+
+struct CellResult {
+  size_t source_index;
+  int source_category;
+  bool is_degenerate;
+  bool contains_point;
+  bool contains_segment;
+  std::vector<int> edge_indices;
+  int color;
+  int tile_idx;
+};
+
+struct EdgeResult {
+  double x1;
+  double y1;
+  double x2;
+  double y2;
+  bool isFinite;
+  bool isCurved;
+  bool isPrimary;
+  bool isWithinCell;
+  const boost::polygon::voronoi_diagram<double>::edge_type* edge_ref; // not for javascript
+  std::vector<double> controll_points;
+};
+
+struct DiagrammResult {
+  std::vector<double> vertices;
+  std::vector<EdgeResult> edges;
+  std::vector<CellResult> cells;
+  int numVerticies;
+};
+
+// edge flags of the flat result
+#define EDGE_FINITE      1
+#define EDGE_CURVED      2
+#define EDGE_PRIMARY     4
+#define EDGE_WITHIN_CELL 8
+
+// cell flags of the flat result
+#define CELL_DEGENERATE       1
+#define CELL_CONTAINS_POINT   2
+#define CELL_CONTAINS_SEGMENT 4
+
+// Structure of arrays variant of DiagrammResult, handed to javascript as typed array views
+struct FlatDiagrammResult {
+  std::vector<double> vertices;             // x, y per vertex
+  std::vector<double> edgeCoords;           // x1, y1, x2, y2 per edge
+  std::vector<unsigned char> edgeFlags;     // EDGE_* per edge
+  std::vector<double> controlPoints;        // x, y of all control points
+  std::vector<int> controlPointOffsets;     // edge i has the controlPoints [offsets[i], offsets[i+1])
+  std::vector<int> cellSourceIndices;
+  std::vector<unsigned char> cellSourceCategories;
+  std::vector<unsigned char> cellFlags;     // CELL_* per cell
+  std::vector<int> cellColors;
+  std::vector<int> cellTileIdxs;
+  std::vector<int> cellEdgeOffsets;         // cell j has the edges cellEdgeIndices[offsets[j], offsets[j+1])
+  std::vector<int> cellEdgeIndices;
+
+  void clear() {
+    vertices.clear();
+    edgeCoords.clear();
+    edgeFlags.clear();
+    controlPoints.clear();
+    controlPointOffsets.assign(1, 0);
+    cellSourceIndices.clear();
+    cellSourceCategories.clear();
+    cellFlags.clear();
+    cellColors.clear();
+    cellTileIdxs.clear();
+    cellEdgeOffsets.assign(1, 0);
+    cellEdgeIndices.clear();
+  }
+};
+
+// point flags of the outline result
+#define OUTLINE_CONTROL_POINT 1 // control point of a quadratic bezier between the points before and after it
+
+// Boundaries between the tiles as polylines, polyline j has the points [pointOffsets[j], pointOffsets[j+1])
+struct OutlineResult {
+  std::vector<double> points;               // x, y per point
+  std::vector<unsigned char> pointFlags;    // OUTLINE_* per point
+  std::vector<int> pointOffsets;
+  std::vector<int> tileIdxs;                // per polyline
+  std::vector<int> colors;
+  std::vector<unsigned char> closed;        // the last point connects to the first
+
+  void clear() {
+    points.clear();
+    pointFlags.clear();
+    pointOffsets.assign(1, 0);
+    tileIdxs.clear();
+    colors.clear();
+    closed.clear();
+  }
+};
+
+void build_diagram(
+  const std::vector<double>& bbox, const std::vector<int>& points,
+  const std::vector<int>& segments,
+  const std::vector<int>& pointColors,
+  const std::vector<int>& segmentColors,
+  const std::vector<int>& pointTileIdxs,
+  const std::vector<int>& segmentTileIdxs,
+  bool cullSites,
+  DiagrammResult* result,
+  FlatDiagrammResult* flat
+  );
+
+void build_outlines(
+  const std::vector<double>& bbox, const std::vector<int>& points,
+  const std::vector<int>& segments,
+  const std::vector<int>& pointColors,
+  const std::vector<int>& segmentColors,
+  const std::vector<int>& pointTileIdxs,
+  const std::vector<int>& segmentTileIdxs,
+  bool cullSites,
+  int tileIdx,
+  OutlineResult* result
+  );
+
+DiagrammResult compute(
+  std::vector<double> bbox, std::vector<int> points,
+  std::vector<int> segments,
+  std::vector<int> pointColors,
+  std::vector<int> segmentColors,
+  std::vector<int> pointTileIdxs,
+  std::vector<int> segmentTileIdxs
+  );
+
+DiagrammResult computeCulled(
+  std::vector<double> bbox, std::vector<int> points,
+  std::vector<int> segments,
+  std::vector<int> pointColors,
+  std::vector<int> segmentColors,
+  std::vector<int> pointTileIdxs,
+  std::vector<int> segmentTileIdxs
+  );
+
+// diagram of a tiling from the sites of one tile and the tile transforms (a, b, c, d, e, f per tile)
+void build_tiled_diagram(
+  const std::vector<double>& bbox,
+  const std::vector<double>& points,
+  const std::vector<double>& segments,
+  const std::vector<double>& tileTransforms,
+  const std::vector<int>& tileColors,
+  const std::vector<int>& tileIdxs,
+  int fundamentalTile,
+  DiagrammResult* result,
+  FlatDiagrammResult* flat
+  );
+
+DiagrammResult computeTiled(
+  std::vector<double> bbox,
+  std::vector<double> points,
+  std::vector<double> segments,
+  std::vector<double> tileTransforms,
+  std::vector<int> tileColors,
+  std::vector<int> tileIdxs,
+  int fundamentalTile
+  );
+
+#endif
@@ -0,0 +1,430 @@
+// Checks of the voronoi diagram builders on small generated tilings, run by ctest (native build only)
+#include "voronoi.h"
+#include <cstdio>
+#include <cmath>
+#include <map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+int failures = 0;
+
+#define CHECK(cond)                                                   \
+  do                                                                  \
+  {                                                                   \
+    if (!(cond))                                                      \
+    {                                                                 \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                     \
+    }                                                                 \
+  } while (0)
+
+struct Sites
+{
+  vector<int> points, segments, pointColors, segmentColors, pointTileIdxs, segmentTileIdxs;
+};
+
+// deterministic pseudo random numbers in [0, n)
+int nextRandom(unsigned &state, int n)
+{
+  state = state * 1103515245u + 12345u;
+  return (int)((state >> 16) % (unsigned)n);
+}
+
+/* tiles x tiles tiles of size x size, each with a jittered L of two segments and a point. The tile colors repeat
+   every three tiles */
+Sites makeTiling(int tiles, int size)
+{
+  Sites s;
+  unsigned state = 7;
+  for (int ty = 0; ty < tiles; ty++)
+    for (int tx = 0; tx < tiles; tx++)
+    {
+      int tileIdx = ty * tiles + tx;
+      int cx = tx * size + size / 2 + nextRandom(state, 9) - 4, cy = ty * size + size / 2 + nextRandom(state, 9) - 4;
+      int arm = size / 4 + nextRandom(state, size / 8);
+      int segments[] = {cx - arm, cy, cx, cy,
+                        cx, cy, cx, cy - arm};
+      s.segments.insert(s.segments.end(), segments, segments + 8);
+      for (int i = 0; i < 2; i++)
+      {
+        s.segmentColors.push_back(tileIdx % 3);
+        s.segmentTileIdxs.push_back(tileIdx);
+      }
+      s.points.push_back(cx + arm / 2);
+      s.points.push_back(cy + arm / 2 + nextRandom(state, 5));
+      s.pointColors.push_back(tileIdx % 3);
+      s.pointTileIdxs.push_back(tileIdx);
+    }
+  return s;
+}
+
+/* a cell by the category and source index of its site. The end points of segments are shared between segments and
+   which of them owns the cell depends on the construction order, those cells are identified by the point */
+typedef pair<int, pair<long, long> > CellKey;
+
+CellKey cellKey(const CellResult &cell, const Sites &s)
+{
+  if (cell.source_category != 1 && cell.source_category != 2)
+    return make_pair(cell.source_category, make_pair((long)cell.source_index, 0L));
+  size_t i = (cell.source_index - s.points.size() / 2) * 4 + (cell.source_category == 2 ? 2 : 0);
+  return make_pair(1, make_pair((long)s.segments[i], (long)s.segments[i + 1]));
+}
+
+// the clipped edges of every cell that reaches into the bbox
+typedef map<CellKey, vector<const EdgeResult *> > ClippedCells;
+
+ClippedCells clippedCells(const DiagrammResult &d, const Sites &s)
+{
+  ClippedCells cells;
+  for (size_t j = 0; j < d.cells.size(); j++)
+  {
+    const CellResult &cell = d.cells[j];
+    vector<const EdgeResult *> &edges = cells[cellKey(cell, s)];
+    CHECK(edges.empty()); // every site has one cell
+    for (size_t k = 0; k < cell.edge_indices.size(); k++)
+      edges.push_back(&d.edges[cell.edge_indices[k]]);
+    if (edges.empty())
+      cells.erase(cellKey(cell, s));
+  }
+  return cells;
+}
+
+/* same geometry and flags, except isFinite: an edge to a culled site can be infinite in the culled diagram and
+   finite in the complete one */
+bool sameEdge(const EdgeResult &a, const EdgeResult &b)
+{
+  const double eps = 1e-6;
+  if (fabs(a.x1 - b.x1) > eps || fabs(a.y1 - b.y1) > eps || fabs(a.x2 - b.x2) > eps || fabs(a.y2 - b.y2) > eps)
+    return false;
+  if (a.isCurved != b.isCurved || a.isPrimary != b.isPrimary || a.isWithinCell != b.isWithinCell)
+    return false;
+  if (a.controll_points.size() != b.controll_points.size())
+    return false;
+  for (size_t i = 0; i < a.controll_points.size(); i++)
+    if (fabs(a.controll_points[i] - b.controll_points[i]) > eps)
+      return false;
+  return true;
+}
+
+bool sameCells(const ClippedCells &a, const ClippedCells &b)
+{
+  if (a.size() != b.size())
+    return false;
+  for (ClippedCells::const_iterator it = a.begin(); it != a.end(); ++it)
+  {
+    ClippedCells::const_iterator other = b.find(it->first);
+    if (other == b.end() || other->second.size() != it->second.size())
+      return false;
+    vector<bool> used(other->second.size(), false);
+    for (size_t i = 0; i < it->second.size(); i++)
+    {
+      size_t k = 0;
+      while (k < used.size() && (used[k] || !sameEdge(*it->second[i], *other->second[k])))
+        k++;
+      if (k == used.size())
+        return false;
+      used[k] = true;
+    }
+  }
+  return true;
+}
+
+// color and tile of the cell of every site of a, the same sites have the same cells in b
+bool sameCellAttributes(const DiagrammResult &a, const DiagrammResult &b, const Sites &s)
+{
+  map<CellKey, pair<int, int> > attributes;
+  for (size_t j = 0; j < b.cells.size(); j++)
+    attributes[cellKey(b.cells[j], s)] = make_pair(b.cells[j].color, b.cells[j].tile_idx);
+  for (size_t j = 0; j < a.cells.size(); j++)
+  {
+    map<CellKey, pair<int, int> >::const_iterator it = attributes.find(cellKey(a.cells[j], s));
+    if (it == attributes.end() || it->second != make_pair(a.cells[j].color, a.cells[j].tile_idx))
+      return false;
+  }
+  return true;
+}
+
+/* the culled diagram clipped to the bbox is the complete diagram clipped to the bbox, for bboxes inside, across and
+   partly outside of a dense tiling */
+void testCulling()
+{
+  const int tiles = 12, size = 100;
+  Sites s = makeTiling(tiles, size);
+  double bboxes[][4] = {{500, 500, 600, 600},      // one tile
+                        {430, 170, 770, 290},      // across tiles
+                        {0, 0, 120, 120},          // corner of the tiling
+                        {1100, -50, 1300, 250},    // partly outside of it
+                        {0, 0, 1200, 1200}};       // all of it, nothing is culled
+  for (int b = 0; b < 5; b++)
+  {
+    vector<double> bbox(bboxes[b], bboxes[b] + 4);
+    DiagrammResult full = compute(bbox, s.points, s.segments, s.pointColors, s.segmentColors, s.pointTileIdxs, s.segmentTileIdxs);
+    DiagrammResult culled = computeCulled(bbox, s.points, s.segments, s.pointColors, s.segmentColors, s.pointTileIdxs, s.segmentTileIdxs);
+    ClippedCells fullCells = clippedCells(full, s), culledCells = clippedCells(culled, s);
+    CHECK(!fullCells.empty());
+    CHECK(sameCells(culledCells, fullCells));
+    CHECK(sameCellAttributes(culled, full, s));
+    if (b < 4)
+      CHECK(culled.cells.size() < full.cells.size());
+    else
+      CHECK(culled.cells.size() == full.cells.size());
+  }
+}
+
+/* a p2 tiling of tiles x tiles squares of size x size, every other tile turned by 180 degrees around its center. The
+   template is an L of two segments and a point, the sites of all tiles are numbered like in build_tiled_diagram */
+struct Tiling
+{
+  vector<double> points, segments, tileTransforms;
+  vector<int> tileColors, tileIdxs;
+  Sites sites;
+};
+
+Tiling makeP2Tiling(int tiles, int size)
+{
+  Tiling t;
+  double points[] = {0.62 * size, 0.7 * size};
+  double segments[] = {0.2 * size, 0.3 * size, 0.55 * size, 0.3 * size,
+                       0.55 * size, 0.3 * size, 0.55 * size, 0.58 * size};
+  t.points.assign(points, points + 2);
+  t.segments.assign(segments, segments + 8);
+  for (int ty = 0; ty < tiles; ty++)
+    for (int tx = 0; tx < tiles; tx++)
+    {
+      int k = ty * tiles + tx;
+      bool turned = (tx + ty) % 2;
+      double T[] = {turned ? -1.0 : 1.0, 0, 0, turned ? -1.0 : 1.0,
+                    (double)(tx * size + (turned ? size : 0)), (double)(ty * size + (turned ? size : 0))};
+      t.tileTransforms.insert(t.tileTransforms.end(), T, T + 6);
+      t.tileColors.push_back(k % 3);
+      t.tileIdxs.push_back(100 + k);
+    }
+  int numTiles = tiles * tiles;
+  for (int k = 0; k < numTiles; k++)
+  {
+    const double *T = &t.tileTransforms[6 * k];
+    for (size_t i = 0; i < t.points.size(); i += 2)
+    {
+      t.sites.points.push_back((int)round(T[0] * t.points[i] + T[2] * t.points[i + 1] + T[4]));
+      t.sites.points.push_back((int)round(T[1] * t.points[i] + T[3] * t.points[i + 1] + T[5]));
+      t.sites.pointColors.push_back(t.tileColors[k]);
+      t.sites.pointTileIdxs.push_back(t.tileIdxs[k]);
+    }
+  }
+  for (int k = 0; k < numTiles; k++)
+  {
+    const double *T = &t.tileTransforms[6 * k];
+    for (size_t i = 0; i < t.segments.size(); i += 2)
+    {
+      t.sites.segments.push_back((int)round(T[0] * t.segments[i] + T[2] * t.segments[i + 1] + T[4]));
+      t.sites.segments.push_back((int)round(T[1] * t.segments[i] + T[3] * t.segments[i + 1] + T[5]));
+    }
+    for (size_t i = 0; i < t.segments.size(); i += 4)
+    {
+      t.sites.segmentColors.push_back(t.tileColors[k]);
+      t.sites.segmentTileIdxs.push_back(t.tileIdxs[k]);
+    }
+  }
+  return t;
+}
+
+/* the tiled diagram clipped to a bbox away from the border of the tiling is the complete diagram clipped to it, and is
+   built from a ring of tiles instead of all of them */
+void testTiled()
+{
+  const int tiles = 12, size = 100;
+  Tiling t = makeP2Tiling(tiles, size);
+  const Sites &s = t.sites;
+  double bboxes[][4] = {{500, 500, 600, 600},  // one tile
+                        {330, 420, 870, 710},  // across tiles
+                        {200, 200, 1000, 1000}};
+  for (int b = 0; b < 3; b++)
+  {
+    vector<double> bbox(bboxes[b], bboxes[b] + 4);
+    DiagrammResult full = compute(bbox, s.points, s.segments, s.pointColors, s.segmentColors, s.pointTileIdxs, s.segmentTileIdxs);
+    DiagrammResult tiled = computeTiled(bbox, t.points, t.segments, t.tileTransforms, t.tileColors, t.tileIdxs, -1);
+    ClippedCells fullCells = clippedCells(full, s), tiledCells = clippedCells(tiled, s);
+    CHECK(!fullCells.empty());
+    CHECK(sameCells(tiledCells, fullCells));
+    CHECK(sameCellAttributes(tiled, full, s));
+    // the copies of the fundamental cells repeat their vertices in every tile, the complete diagram has each once
+    CHECK(tiled.numVerticies % (tiles * tiles) == 0 && tiled.numVerticies != full.numVerticies);
+    // cells without an edge in the bbox are left out
+    for (size_t j = 0; j < tiled.cells.size(); j++)
+      CHECK(!tiled.cells[j].edge_indices.empty());
+  }
+}
+
+struct Segment
+{
+  double x1, y1, x2, y2;
+};
+
+bool sameSegment(const Segment &a, const Segment &b)
+{
+  const double eps = 1e-6;
+  return fabs(a.x1 - b.x1) <= eps && fabs(a.y1 - b.y1) <= eps && fabs(a.x2 - b.x2) <= eps && fabs(a.y2 - b.y2) <= eps;
+}
+
+// every segment of a matches a different one of b
+bool sameSegments(const vector<Segment> &a, const vector<Segment> &b)
+{
+  if (a.size() != b.size())
+    return false;
+  vector<bool> used(b.size(), false);
+  for (size_t i = 0; i < a.size(); i++)
+  {
+    size_t k = 0;
+    while (k < b.size() && (used[k] || !sameSegment(a[i], b[k])))
+      k++;
+    if (k == b.size())
+      return false;
+    used[k] = true;
+  }
+  return true;
+}
+
+/* the outline of a tile is made of the clipped edges of its cells towards other tiles, in the direction of the cell
+   edges. Zero length edges at the bbox border are left out on both sides */
+void testOutlines()
+{
+  Sites s = makeTiling(8, 100);
+  double bboxes[][4] = {{150, 150, 650, 650},    // inside of the tiling
+                        {-300, -300, 1100, 1100}}; // around it, the infinite edges are clipped
+  for (int b = 0; b < 2; b++)
+  {
+    vector<double> bbox(bboxes[b], bboxes[b] + 4);
+    DiagrammResult d = compute(bbox, s.points, s.segments, s.pointColors, s.segmentColors, s.pointTileIdxs, s.segmentTileIdxs);
+    map<int, vector<Segment> > expected;
+    for (size_t j = 0; j < d.cells.size(); j++)
+      for (size_t k = 0; k < d.cells[j].edge_indices.size(); k++)
+      {
+        const EdgeResult &e = d.edges[d.cells[j].edge_indices[k]];
+        if (!e.isWithinCell && (e.x1 != e.x2 || e.y1 != e.y2))
+          expected[d.cells[j].tile_idx].push_back({e.x1, e.y1, e.x2, e.y2});
+      }
+
+    OutlineResult outlines;
+    build_outlines(bbox, s.points, s.segments, s.pointColors, s.segmentColors, s.pointTileIdxs, s.segmentTileIdxs, false, -1, &outlines);
+    map<int, vector<Segment> > traced;
+    CHECK(outlines.pointOffsets.size() == outlines.closed.size() + 1);
+    for (size_t j = 0; j + 1 < outlines.pointOffsets.size(); j++)
+    {
+      int first = outlines.pointOffsets[j], end = outlines.pointOffsets[j + 1];
+      vector<int> ends; // points without the control points
+      for (int i = first; i < end; i++)
+        if (!(outlines.pointFlags[i] & OUTLINE_CONTROL_POINT))
+          ends.push_back(i);
+      if (outlines.closed[j])
+        ends.push_back(ends[0]);
+      for (size_t i = 0; i + 1 < ends.size(); i++)
+      {
+        Segment e = {outlines.points[2 * ends[i]], outlines.points[2 * ends[i] + 1],
+                     outlines.points[2 * ends[i + 1]], outlines.points[2 * ends[i + 1] + 1]};
+        if (e.x1 != e.x2 || e.y1 != e.y2)
+          traced[outlines.tileIdxs[j]].push_back(e);
+      }
+      CHECK(outlines.colors[j] == outlines.tileIdxs[j] % 3);
+    }
+    CHECK(traced.size() == expected.size());
+    for (map<int, vector<Segment> >::const_iterator it = expected.begin(); it != expected.end(); ++it)
+      CHECK(sameSegments(it->second, traced[it->first]));
+
+    // the outline of a single tile is its part of all outlines
+    OutlineResult single;
+    int tile = expected.begin()->first;
+    build_outlines(bbox, s.points, s.segments, s.pointColors, s.segmentColors, s.pointTileIdxs, s.segmentTileIdxs, false, tile, &single);
+    CHECK(!single.closed.empty());
+    for (size_t j = 0; j < single.tileIdxs.size(); j++)
+      CHECK(single.tileIdxs[j] == tile);
+  }
+}
+
+// compute keeps every site, also those far outside of the bbox
+void testComputeKeepsAllSites()
+{
+  Sites s = makeTiling(6, 100);
+  vector<double> bbox = {0, 0, 100, 100};
+  DiagrammResult full = compute(bbox, s.points, s.segments, s.pointColors, s.segmentColors, s.pointTileIdxs, s.segmentTileIdxs);
+  // a point cell per point and a cell per segment and per segment end point (shared ends are one cell)
+  size_t segmentCells = 0;
+  for (size_t j = 0; j < full.cells.size(); j++)
+    if (full.cells[j].contains_segment)
+      segmentCells++;
+  CHECK(segmentCells == s.segments.size() / 4);
+  CHECK(full.cells.size() > s.points.size() / 2 + s.segments.size() / 4);
+}
+
+/* the color and tile of a cell are those of its own site, also for segment cells behind point sites, and an edge is
+   within a cell if the cells on both sides belong to the same tile */
+void testCellAttributes()
+{
+  Sites s;
+  int points[] = {50, 50, 10, 12};
+  int segments[] = {0, 0, 20, 0,
+                    80, 0, 100, 0,
+                    50, 90, 50, 70};
+  s.points.assign(points, points + 4);
+  s.segments.assign(segments, segments + 12);
+  s.pointColors = {11, 12};
+  s.pointTileIdxs = {7, 3};
+  s.segmentColors = {21, 22, 23};
+  s.segmentTileIdxs = {3, 5, 7};
+  vector<double> bbox = {-50, -50, 150, 150};
+  DiagrammResult d = compute(bbox, s.points, s.segments, s.pointColors, s.segmentColors, s.pointTileIdxs, s.segmentTileIdxs);
+
+  size_t numPoints = s.points.size() / 2;
+  vector<int> edgeTiles(d.edges.size(), -1);
+  for (size_t j = 0; j < d.cells.size(); j++)
+  {
+    const CellResult &cell = d.cells[j];
+    if (cell.source_category == 0)
+    {
+      CHECK(cell.source_index < numPoints);
+      CHECK(cell.color == s.pointColors[cell.source_index]);
+      CHECK(cell.tile_idx == s.pointTileIdxs[cell.source_index]);
+    }
+    else
+    {
+      CHECK(cell.source_index >= numPoints && cell.source_index < numPoints + s.segments.size() / 4);
+      CHECK(cell.color == s.segmentColors[cell.source_index - numPoints]);
+      CHECK(cell.tile_idx == s.segmentTileIdxs[cell.source_index - numPoints]);
+    }
+    for (size_t k = 0; k < cell.edge_indices.size(); k++)
+      edgeTiles[cell.edge_indices[k]] = cell.tile_idx;
+  }
+
+  // the twin of an edge is the edge of the neighbouring cell in the other direction
+  int within = 0, between = 0;
+  for (size_t i = 0; i < d.edges.size(); i++)
+  {
+    const EdgeResult &e = d.edges[i];
+    size_t twin = 0;
+    while (twin < d.edges.size() && !(twin != i && d.edges[twin].x1 == e.x2 && d.edges[twin].y1 == e.y2 &&
+                                      d.edges[twin].x2 == e.x1 && d.edges[twin].y2 == e.y1))
+      twin++;
+    CHECK(twin < d.edges.size());
+    if (twin == d.edges.size())
+      continue;
+    CHECK(e.isWithinCell == (edgeTiles[i] == edgeTiles[twin]));
+    (e.isWithinCell ? within : between)++;
+  }
+  CHECK(within > 0 && between > 0);
+}
+
+int main()
+{
+  testCulling();
+  testCellAttributes();
+  testTiled();
+  testOutlines();
+  testComputeKeepsAllSites();
+
+  if (failures)
+    printf("%d checks failed\n", failures);
+  else
+    printf("all checks passed\n");
+  return failures ? 1 : 0;
+}